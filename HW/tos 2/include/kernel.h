@@ -20,8 +20,37 @@ typedef int BOOL;
 
 int k_strlen(const char* str);
 void* k_memcpy(void* dst, const void* src, int len);
+void* k_memset(void* dst, int c, int len);
 int k_memcmp(const void* b1, const void* b2, int len);
 
+/*
+ * Enables the SSE2 path of k_memcpy()/k_memset() if CPUID reports SSE2.
+ * Only call this once the kernel preserves the XMM registers across
+ * context switches. Returns TRUE if the SSE2 path is now in use.
+ */
+BOOL k_mem_enable_sse2();
+void k_mem_disable_sse2();
+
+
+/*=====>>> cpu.c <<<========================================================*/
+
+/*
+ * Feature flags returned in EDX by CPUID leaf 1
+ */
+#define CPU_FEATURE_FPU		(1 << 0)
+#define CPU_FEATURE_TSC		(1 << 4)
+#define CPU_FEATURE_APIC	(1 << 9)
+#define CPU_FEATURE_PGE		(1 << 13)
+#define CPU_FEATURE_FXSR	(1 << 24)
+#define CPU_FEATURE_SSE		(1 << 25)
+#define CPU_FEATURE_SSE2	(1 << 26)
+
+BOOL has_cpuid();
+void cpuid(unsigned leaf, unsigned* eax, unsigned* ebx,
+	   unsigned* ecx, unsigned* edx);
+unsigned cpu_features();
+unsigned read_tsc();
+
 
 /*=====>>> mem.c <<<========================================================*/
 
@@ -40,26 +69,148 @@ LONG peek_l(MEM_ADDR addr);
 
 /*=====>>> window.c <<<=====================================================*/
 
-typedef struct {
+/*
+ * A screen cell as stored in video memory: the character in the
+ * low byte and its colour attribute in the high byte.
+ */
+typedef WORD CELL;
+
+#define VGA_BLACK		0x0
+#define VGA_BLUE		0x1
+#define VGA_GREEN		0x2
+#define VGA_CYAN		0x3
+#define VGA_RED			0x4
+#define VGA_MAGENTA		0x5
+#define VGA_BROWN		0x6
+#define VGA_LIGHT_GRAY		0x7
+#define VGA_DARK_GRAY		0x8
+#define VGA_LIGHT_BLUE		0x9
+#define VGA_LIGHT_GREEN		0xA
+#define VGA_LIGHT_CYAN		0xB
+#define VGA_LIGHT_RED		0xC
+#define VGA_LIGHT_MAGENTA	0xD
+#define VGA_YELLOW		0xE
+#define VGA_BRIGHT_WHITE	0xF
+
+#define MAKE_COLOR(fg, bg)	((BYTE) (((bg) << 4) | (fg)))
+#define MAKE_CELL(ch, color)	((CELL) ((BYTE) (ch) | ((WORD) (color) << 8)))
+
+/*
+ * Colour used by windows that leave WINDOW.color at 0
+ * (black on black would be invisible anyway).
+ */
+#define DEFAULT_COLOR		MAKE_COLOR(VGA_BRIGHT_WHITE, VGA_BLACK)
+
+typedef struct _WINDOW {
   int  x, y;
   int  width, height;
   int  cursor_x, cursor_y;
   char cursor_char;
+  BYTE color;
+  CELL* backing;           /* Off-screen contents; NULL if not managed */
+  struct _WINDOW* below;   /* Next window down in the z-order */
 } WINDOW;
 
 extern WINDOW* kernel_window;
+extern WINDOW* top_window;
 
 
 void move_cursor(WINDOW* wnd, int x, int y);
 void remove_cursor(WINDOW* wnd);
 void show_cursor(WINDOW* wnd);
 void clear_window(WINDOW* wnd);
+void set_window_color(WINDOW* wnd, BYTE color);
+void output_cells(WINDOW* wnd, int x, int y, const CELL* cells, int len);
+void open_window(WINDOW* wnd, CELL* backing);
+void close_window(WINDOW* wnd);
+void raise_window(WINDOW* wnd);
+void move_window(WINDOW* wnd, int x, int y);
+WINDOW* open_error_window();
 void output_char(WINDOW* wnd, unsigned char ch);
 void output_string(WINDOW* wnd, const char *str);
 void wprintf(WINDOW* wnd, const char* fmt, ...);
 void kprintf(const char* fmt, ...);
 
 
+/*=====>>> frame.c <<<======================================================*/
+
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1 << PAGE_SHIFT)
+
+/*
+ * BIOS memory map (INT 15h, AX=E820h) as collected by the boot loader
+ * at MEMORY_MAP_ADDR
+ */
+#define MEMORY_MAP_ADDR		0x500
+#define MEMORY_MAP_MAGIC	0x534D4150	/* 'SMAP' */
+#define MAX_MEMORY_REGIONS	32
+
+#define MEMORY_AVAILABLE	1
+#define MEMORY_RESERVED		2
+#define MEMORY_ACPI_RECLAIM	3
+#define MEMORY_ACPI_NVS		4
+
+typedef struct
+{
+    LONG base_low;
+    LONG base_high;
+    LONG length_low;
+    LONG length_high;
+    LONG type;
+} MEMORY_REGION;
+
+typedef struct
+{
+    LONG          magic;
+    LONG          num_regions;
+    MEMORY_REGION region[MAX_MEMORY_REGIONS];
+} MEMORY_MAP;
+
+void init_page_frames(MEMORY_MAP* map);
+MEM_ADDR alloc_page_frame();
+void free_page_frame(MEM_ADDR addr);
+unsigned num_free_page_frames();
+MEM_ADDR get_memory_top();
+void print_memory_map(WINDOW* wnd);
+
+
+/*=====>>> heap.c <<<======================================================*/
+
+/*
+ * Heap blocks range from one page (2^HEAP_MIN_ORDER bytes) up
+ * to 2^HEAP_MAX_ORDER bytes
+ */
+#define HEAP_MIN_ORDER		PAGE_SHIFT
+#define HEAP_MAX_ORDER		24
+
+/*
+ * Number of size classes for small objects (16 .. 2048 bytes)
+ */
+#define NUM_SIZE_CLASSES	8
+
+typedef struct
+{
+    unsigned heap_size;
+    unsigned free_bytes;
+    unsigned largest_free;
+    unsigned small_pages;
+    unsigned small_allocated;
+    unsigned small_cached;
+    unsigned large_allocated;
+    unsigned num_malloc;
+    unsigned num_free;
+    unsigned num_failed;
+    unsigned free_blocks[HEAP_MAX_ORDER - HEAP_MIN_ORDER + 1];
+} HEAP_STATS;
+
+void init_heap();
+void init_heap_region(void* start, unsigned size);
+void* k_malloc(int size);
+void k_free(void* ptr);
+void get_heap_stats(HEAP_STATS* stats);
+void print_heap_stats(WINDOW* wnd);
+
+
 /*=====>>> process.c <<<====================================================*/
 
 /*
@@ -68,6 +219,13 @@ void kprintf(const char* fmt, ...);
 #define MAX_PROCS		20
 
 
+/*
+ * Process stacks grow down from STACK_TOP, STACK_SIZE bytes each
+ */
+#define STACK_TOP		(640 * 1024)
+#define STACK_SIZE		(16 * 1024)
+
+
 /*
  * Max. number of ready queues
  */
@@ -80,6 +238,9 @@ void kprintf(const char* fmt, ...);
 #define STATE_RECEIVE_BLOCKED	3
 #define STATE_MESSAGE_BLOCKED	4
 #define STATE_INTR_BLOCKED 	5
+#define STATE_CHANNEL_BLOCKED	6
+#define STATE_SYNC_BLOCKED	7
+#define STATE_PERIOD_BLOCKED	8
 
 
 #define MAGIC_PCB 0x4321dcba
@@ -91,6 +252,16 @@ typedef struct _PCB* PROCESS;
 struct _PORT_DEF;
 typedef struct _PORT_DEF* PORT;
 
+/*
+ * The FPU, MMX and SSE registers of a process as fxsave stores them;
+ * fnsave, on CPUs without it, uses the first 108 bytes. See fpu.c.
+ */
+#define FPU_STATE_SIZE		512
+
+typedef struct {
+    BYTE data[FPU_STATE_SIZE];
+} __attribute__ ((aligned (16))) FPU_STATE;
+
 typedef struct _PCB {
     unsigned       magic;
     unsigned       used;
@@ -104,6 +275,23 @@ typedef struct _PCB {
     PROCESS        next;
     PROCESS        prev;
     char*          name;
+    MEM_ADDR       page_dir;	/* 0 = kernel-only process */
+    unsigned       grant_slots;	/* grant window slots in use */
+    unsigned       timeout_tick;	/* deadline of a timed wait */
+    PROCESS        next_timeout;	/* next process on the timeout list */
+    BOOL           timed_out;	/* last timed wait ran out */
+    PORT           blocked_port;	/* port whose send list we are on */
+    PROCESS        reply_from;	/* receiver we are reply blocked on */
+    int            cpu;		/* CPU whose ready queue it is on */
+    unsigned       affinity;	/* CPUs it may run on, see CPU_MASK() */
+    unsigned       edf_period;	/* ticks; 0 = not an EDF process */
+    unsigned       edf_budget;	/* ticks of CPU time per period */
+    unsigned       edf_left;	/* budget left in this period */
+    unsigned       edf_deadline;	/* tick the current period ends */
+    unsigned       edf_misses;	/* periods that ended unfinished */
+    BOOL           fpu_used;	/* fpu holds a state */
+    int            fpu_cpu;	/* CPU that last loaded fpu, or -1 */
+    FPU_STATE      fpu;		/* saved while another process has the FPU */
 } PCB;
 
 
@@ -128,19 +316,213 @@ void init_process();
 
 
 
+/*=====>>> smp.c <<<========================================================*/
+
+#define MAX_CPUS		8
+
+#define CPU_MASK(n)		(1 << (n))
+#define ALL_CPUS		0xFFFFFFFF
+
+/*
+ * The CPU that booted the system. The 8259 delivers all device
+ * interrupts to it.
+ */
+#define BOOT_CPU		0
+
+typedef struct {
+    volatile int locked;
+} SPINLOCK;
+
+#define SPINLOCK_INIT		{ 0 }
+
+/*
+ * Per-CPU data. The %fs segment of each CPU starts at its CPU_DEF,
+ * so this_cpu() is a single load; self must remain the first field.
+ */
+typedef struct _CPU_DEF {
+    struct _CPU_DEF* self;
+    int              id;		/* index into cpus[] */
+    int              apic_id;
+    volatile BOOL    online;
+    PROCESS          current;		/* active_proc of this CPU */
+    PROCESS          idle;		/* runs when nothing else is ready */
+    SPINLOCK         lock;		/* protects the ready queue */
+    PCB*             run_queue[MAX_READY_QUEUES];
+    unsigned         run_queue_state;	/* bit n set: run_queue[n] not empty */
+    PCB*             edf_queue;		/* ready EDF processes by deadline */
+    unsigned         edf_load;		/* admitted EDF utilization */
+    int              nr_ready;		/* processes on the ready queue */
+    unsigned         migrations;	/* processes moved here by balance.c */
+    unsigned         local_ticks;	/* interrupts of the local APIC timer */
+    MEM_ADDR         page_dir;		/* page directory loaded in CR3 */
+    PROCESS          fpu_owner;		/* whose state the FPU holds */
+    BOOL             fpu_dirty;		/* newer than fpu_owner->fpu */
+} CPU_DEF;
+
+extern CPU_DEF cpus[];
+extern int num_cpus;
+
+#ifdef TOS_HOST
+
+#define this_cpu()		(&cpus[0])
+
+#define spin_lock_irqsave(lock, save)		(save) = 0;
+#define spin_unlock_irqrestore(lock, save)	(void) (save);
+
+#define smp_mb()		__sync_synchronize()
+
+#else
+
+static inline CPU_DEF* this_cpu()
+{
+    CPU_DEF* cpu;
+
+    /* volatile: a process may continue on another CPU after resign() */
+    asm volatile ("movl %%fs:0,%0" : "=r" (cpu));
+    return cpu;
+}
+
+#define spin_lock_irqsave(lock, save)	asm ("pushfl");                   \
+					asm ("popl %0" : "=r" (save) : ); \
+					asm ("cli");                      \
+					spin_lock(lock);
+
+#define spin_unlock_irqrestore(lock, save)	spin_unlock(lock);        \
+					asm ("pushl %0" : : "m" (save));  \
+					asm ("popfl");
+
+/* orders earlier stores before later loads, as seen by other CPUs */
+#define smp_mb()		asm volatile ("lock; addl $0,(%%esp)" : : : "memory")
+
+#endif
+
+void spin_lock(SPINLOCK* lock);
+BOOL spin_trylock(SPINLOCK* lock);
+void spin_unlock(SPINLOCK* lock);
+void kernel_lock_enter();
+void kernel_lock_leave();
+void finish_switch();
+void init_cpus();
+void init_smp();
+
+
+/*=====>>> fpu.c <<<========================================================*/
+
+void init_fpu();
+void fpu_switch(PROCESS next);
+BOOL handle_fpu_trap();
+
+
+/*=====>>> apic.c <<<=======================================================*/
+
+/*
+ * Vectors of the local APIC's own interrupts. LAPIC_TIMER_VECTOR must
+ * match the stub in intr.c.
+ */
+#define LAPIC_TIMER_VECTOR	0x70
+#define SPURIOUS_VECTOR		0xFF
+
+extern MEM_ADDR lapic_base;
+extern BOOL ioapic_enabled;
+
+BOOL init_lapic(MEM_ADDR phys);
+void enable_lapic();
+int lapic_id();
+void lapic_send_ipi(int apic_id, unsigned command);
+void lapic_eoi();
+void start_lapic_timer();
+void lapic_timer_irq();
+void udelay(unsigned usecs);
+void set_isa_irq_pin(int irq, int pin, BOOL active_low, BOOL level);
+void init_ioapic(MEM_ADDR phys);
+void set_irq_cpu(int intr_no, int cpu);
+int irq_cpu(int intr_no);
+
+
 /*=====>>> dispatch.c <<<===================================================*/
 
-extern PROCESS active_proc;
-extern PCB* ready_queue[];
+/*
+ * The process running on the calling CPU and that CPU's ready queues
+ */
+#define active_proc		(this_cpu()->current)
+#define ready_queue		(this_cpu()->run_queue)
+#define ready_lists_state	(this_cpu()->run_queue_state)
 
 
+int pick_cpu(unsigned mask);
+int get_highest_priority(unsigned value);
 PROCESS dispatcher();
 void add_ready_queue (PROCESS proc);
 void remove_ready_queue (PROCESS proc);
+void set_edf_budget (PROCESS proc, unsigned left, unsigned deadline);
 void resign();
 void init_dispatcher();
 
 
+/*=====>>> balance.c <<<====================================================*/
+
+BOOL steal_work();
+void balance_cpus();
+void set_affinity(PROCESS proc, unsigned mask);
+void print_cpus(WINDOW* wnd);
+
+
+/*=====>>> edf.c <<<========================================================*/
+
+/*
+ * Utilization is counted in units of 1/EDF_SCALE of a CPU
+ */
+#define EDF_SCALE		1024
+
+BOOL set_edf(PROCESS proc, unsigned period, unsigned budget);
+void edf_next_period();
+void edf_tick();
+void print_edf(WINDOW* wnd);
+
+
+/*=====>>> paging.c <<<=====================================================*/
+
+/*
+ * Page table entry flags
+ */
+#define PAGE_PRESENT		0x001
+#define PAGE_WRITABLE		0x002
+#define PAGE_USER		0x004
+#define PAGE_WRITE_THROUGH	0x008
+#define PAGE_NO_CACHE		0x010
+#define PAGE_GLOBAL		0x100
+
+/*
+ * Linear addresses below USER_SPACE_BASE are the kernel's identity map
+ * and are shared by all address spaces
+ */
+#define USER_SPACE_BASE		0x40000000
+
+/*
+ * Memory-mapped device registers (map_mmio()) get the last 4MB of the
+ * kernel part, uncached
+ */
+#define MMIO_BASE		(USER_SPACE_BASE - 0x400000)
+
+/*
+ * The identity map ends where the MMIO window begins. The page frame
+ * allocator hands out no RAM above, which the kernel could not reach.
+ */
+#define IDENTITY_MAP_END	MMIO_BASE
+
+extern BOOL paging_enabled;
+
+void init_paging();
+MEM_ADDR create_address_space();
+void destroy_address_space(MEM_ADDR page_dir);
+BOOL map_page(MEM_ADDR page_dir, MEM_ADDR virt, MEM_ADDR phys, unsigned flags);
+MEM_ADDR unmap_page(MEM_ADDR page_dir, MEM_ADDR virt);
+MEM_ADDR lookup_page(MEM_ADDR page_dir, MEM_ADDR virt);
+void switch_address_space(PROCESS proc);
+MEM_ADDR map_mmio(MEM_ADDR phys, unsigned size);
+void init_paging_ap();
+
+
 /*=====>>> null.c <<<=======================================================*/
 
 void init_null_process();
@@ -159,6 +541,7 @@ typedef struct _PORT_DEF {
     PROCESS   owner;             /* Owner of this port */
     PROCESS   blocked_list_head; /* First local blocked process */
     PROCESS   blocked_list_tail; /* Last local blocked process */
+    unsigned  posted;            /* Events posted but not yet received */
     struct _PORT_DEF *next;            /* Next port */
 } PORT_DEF;
 
@@ -168,21 +551,329 @@ PORT create_new_port (PROCESS proc);
 void open_port (PORT port);
 void close_port (PORT port);
 void send (PORT dest_port, void* data);
+void post_event (PORT port);
+BOOL send_timeout (PORT dest_port, void* data, unsigned ticks);
 void message (PORT dest_port, void* data);
 void* receive (PROCESS* sender);
+void* receive_timeout (PROCESS* sender, unsigned ticks);
 void reply (PROCESS sender);
 void init_ipc();
 
 
+/*=====>>> grant.c <<<======================================================*/
+
+#define GRANT_READ		1
+#define GRANT_WRITE		2
+
+/*
+ * Grants are mapped into slots of a window at the top of the
+ * receiver's address space. A grant may span at most
+ * GRANT_SLOT_SIZE - PAGE_SIZE bytes.
+ */
+#define GRANT_WINDOW_BASE	0xF0000000
+#define GRANT_SLOT_SIZE		(1024 * 1024)
+#define MAX_GRANT_SLOTS		8
+
+#define MAGIC_GRANT		0x6772616e
+
+typedef struct
+{
+    unsigned magic;
+    PROCESS  owner;		/* Process lending the buffer */
+    void*    buffer;		/* Buffer in the owner's address space */
+    int      length;
+    unsigned access;		/* GRANT_READ and/or GRANT_WRITE */
+    PROCESS  mapped_by;		/* Receiver that has it mapped, or NULL */
+    void*    mapped_addr;
+    int      slot;
+} GRANT;
+
+void init_grant(GRANT* grant, void* buffer, int length, unsigned access);
+void send_grant(PORT dest_port, GRANT* grant);
+void* map_grant(PROCESS sender, GRANT* grant);
+void unmap_grant(GRANT* grant);
+void reply_grant(PROCESS sender, GRANT* grant);
+
+
+/*=====>>> channel.c <<<====================================================*/
+
+#define MAX_CHANNELS		MAX_PROCS
+
+#define MAGIC_CHANNEL		0x6368616e
+
+#define CHANNEL_PRODUCER	0
+#define CHANNEL_CONSUMER	1
+
+typedef struct _CHANNEL_DEF {
+    unsigned          magic;
+    unsigned          used;
+    volatile unsigned head;		/* Items written, producer only */
+    volatile unsigned tail;		/* Items read, consumer only */
+    unsigned          num_items;	/* Power of two */
+    unsigned          item_size;
+    char*             buffer;
+    PROCESS           producer;
+    PROCESS           consumer;
+    volatile BOOL     producer_waiting;	/* Producer blocked on full ring */
+    volatile BOOL     consumer_waiting;	/* Consumer blocked on empty ring */
+    struct _CHANNEL_DEF *next;		/* Next free channel */
+} CHANNEL_DEF;
+
+typedef CHANNEL_DEF* CHANNEL;
+
+CHANNEL create_channel(int num_items, int item_size);
+void attach_channel(CHANNEL ch, int end);
+void destroy_channel(CHANNEL ch);
+void channel_write(CHANNEL ch, const void* item);
+void channel_read(CHANNEL ch, void* item);
+BOOL channel_try_write(CHANNEL ch, const void* item);
+BOOL channel_try_read(CHANNEL ch, void* item);
+int channel_count(CHANNEL ch);
+void init_channels();
+
+
+/*=====>>> names.c <<<======================================================*/
+
+#define MAX_NAME_LEN		15
+#define NAME_TABLE_SIZE		64	/* must be a power of two */
+
+/*
+ * Client-side cache of a name lookup. Initialize with
+ * PORT_REF_INIT("name") and pass to lookup_port_cached().
+ */
+typedef struct {
+    const char* name;
+    PORT        port;
+    unsigned    generation;
+} PORT_REF;
+
+#define PORT_REF_INIT(n)	{ (n), NULL, 0 }
+
+extern unsigned name_generation;
+
+BOOL register_port(const char* name, PORT port);
+void unregister_port(const char* name);
+PORT lookup_port(const char* name);
+PORT lookup_port_cached(PORT_REF* ref);
+void init_names();
+
+
+/*=====>>> sync.c <<<=======================================================*/
+
+#define MAGIC_SEMAPHORE		0x73656d61
+#define MAGIC_CONDVAR		0x636f6e64
+
+typedef struct {
+    unsigned     magic;
+    volatile int count;		/* < 0: number of committed waiters */
+    int          wakeups;	/* signals for waiters not yet queued */
+    PROCESS      wait_head;
+    PROCESS      wait_tail;
+} SEMAPHORE;
+
+typedef struct {
+    SEMAPHORE sem;
+    PROCESS   owner;
+} MUTEX;
+
+typedef struct {
+    unsigned magic;
+    PROCESS  wait_head;
+    PROCESS  wait_tail;
+} CONDVAR;
+
+void init_semaphore(SEMAPHORE* sem, int count);
+void sem_wait(SEMAPHORE* sem);
+BOOL sem_try_wait(SEMAPHORE* sem);
+void sem_signal(SEMAPHORE* sem);
+void init_mutex(MUTEX* mutex);
+void mutex_lock(MUTEX* mutex);
+BOOL mutex_try_lock(MUTEX* mutex);
+void mutex_unlock(MUTEX* mutex);
+void init_condvar(CONDVAR* cv);
+void cond_wait(CONDVAR* cv, MUTEX* mutex);
+void cond_signal(CONDVAR* cv);
+void cond_broadcast(CONDVAR* cv);
+
+
+/*=====>>> irqoff.c <<<=====================================================*/
+
+#define MAX_INTR_OFF_SITES	32
+
+typedef struct {
+    MEM_ADDR           site;		/* return address of intr_off_begin() */
+    const char*        file;
+    int                line;
+    unsigned           count;
+    unsigned           max_cycles;
+    unsigned long long total_cycles;
+} INTR_OFF_SITE;
+
+void intr_off_begin(int saved_flags, const char* file, int line);
+void intr_off_end(int saved_flags);
+void intr_off_switch();
+void reset_intr_off_stats();
+void print_intr_off_stats(WINDOW* wnd, int n);
+void init_intr_off_stats();
+
+
+/*=====>>> trace.c <<<======================================================*/
+
+/*
+ * Event types of the scheduler trace
+ */
+#define TRACE_SWITCH		1	/* proc starts to run; arg: previous */
+#define TRACE_IRQ		2	/* proc interrupted; arg: vector */
+#define TRACE_STATE		3	/* proc changes state; arg: STATE_* */
+#define TRACE_SEND		4	/* proc sends; arg: receiver */
+#define TRACE_RECEIVE		5	/* proc receives; arg: sender */
+#define TRACE_REPLY		6	/* proc replies; arg: sender */
+
+/* arg of TRACE_RECEIVE for events and timeouts, which have no sender */
+#define TRACE_NO_PROC		0xFFFF
+
+/*
+ * One entry of the trace ring, 16 bytes. The dump sent over COM2 is a
+ * TRACE_HEADER, MAX_PROCS process names of TRACE_NAME_LEN bytes and
+ * the events, oldest first; tools/trace reads it.
+ */
+typedef struct {
+    unsigned long long tsc;
+    BYTE               type;
+    BYTE               cpu;
+    WORD               proc;		/* index into pcb[] */
+    unsigned           arg;
+} TRACE_EVENT;
+
+#define TRACE_MAGIC		"TOSTRACE"
+#define TRACE_VERSION		1
+#define TRACE_NAME_LEN		24
+
+typedef struct {
+    char     magic[8];
+    unsigned version;
+    unsigned tsc_per_tick;		/* TSC cycles per timer tick */
+    unsigned num_procs;
+    unsigned num_events;
+    unsigned lost_events;		/* overwritten before the dump */
+} TRACE_HEADER;
+
+#if defined(TRACE_SCHED) && !defined(TOS_HOST)
+#define TRACE(type, proc, arg)	trace_event(type, proc, arg)
+#else
+#define TRACE(type, proc, arg)	do { } while (0)
+#endif
+
+void trace_event(int type, PROCESS proc, unsigned arg);
+BOOL trace_start();
+void trace_stop();
+void trace_dump();
+
+
+/*=====>>> profile.c <<<====================================================*/
+
+#define RTC_IRQ			0x68
+#define PROFILE_HZ		1024
+
+/*
+ * One bucket of the profile, 12 bytes: how often proc was interrupted
+ * at eip. The dump sent over COM2 is a PROFILE_HEADER, MAX_PROCS
+ * process names of PROFILE_NAME_LEN bytes and the buckets in use;
+ * tools/profile reads it.
+ */
+typedef struct {
+    MEM_ADDR eip;
+    WORD     proc;			/* index into pcb[] */
+    WORD     reserved;
+    unsigned count;
+} PROFILE_BUCKET;
+
+#define PROFILE_MAGIC		"TOSPROF"	/* with the '\0', 8 bytes */
+#define PROFILE_VERSION		1
+#define PROFILE_NAME_LEN	24
+
+typedef struct {
+    char     magic[8];
+    unsigned version;
+    unsigned hz;			/* samples per second */
+    unsigned num_procs;
+    unsigned num_buckets;
+    unsigned samples;
+    unsigned dropped;			/* no free bucket left */
+} PROFILE_HEADER;
+
+void profile_irq(MEM_ADDR esp);
+BOOL profile_start();
+void profile_stop();
+void print_profile(WINDOW* wnd, int n);
+void profile_dump();
+
+
+/*=====>>> tasklet.c <<<====================================================*/
+
+typedef struct _TASKLET {
+    void             (*func) (void* data);
+    void*            data;
+    BOOL             scheduled;
+    struct _TASKLET* next;
+} TASKLET;
+
+void init_tasklet(TASKLET* t, void (*func) (void* data), void* data);
+void schedule_tasklet(TASKLET* t);
+void run_tasklets();
+void init_tasklets();
+
+
 /*=====>>> intr.c <<<=======================================================*/
 
+#define EFLAGS_IF	0x200
+
+#ifdef TOS_HOST
+
+/*
+ * Host builds (host-bench) run the portable parts of the kernel
+ * as an ordinary user program, where interrupts cannot be disabled.
+ */
+#define DISABLE_INTR(save)	(save) = 0;
+#define ENABLE_INTR(save)	(void) (save);
+
+#else
+
+#ifdef TRACE_INTR_OFF
+
+/*
+ * Instrumented build: measures how long interrupts stay disabled
+ * (see irqoff.c)
+ */
+#define INTR_OFF_BEGIN(save)	intr_off_begin(save, __FILE__, __LINE__);
+#define INTR_OFF_END(save)	intr_off_end(save);
+
+#else
+
+#define INTR_OFF_BEGIN(save)
+#define INTR_OFF_END(save)
+
+#endif
+
+/*
+ * The outermost DISABLE_INTR() also takes the kernel lock, so that a
+ * critical section excludes the other CPUs as well (see smp.c).
+ */
 #define DISABLE_INTR(save)	asm ("pushfl");                   \
                                 asm ("popl %0" : "=r" (save) : ); \
-				asm ("cli");
-
-#define ENABLE_INTR(save) 	asm ("pushl %0" : : "m" (save)); \
+				asm ("cli");                      \
+				if ((save) & EFLAGS_IF)           \
+				    kernel_lock_enter();          \
+				INTR_OFF_BEGIN(save)
+
+#define ENABLE_INTR(save) 	INTR_OFF_END(save)                \
+				if ((save) & EFLAGS_IF)           \
+				    kernel_lock_leave();          \
+				asm ("pushl %0" : : "m" (save)); \
 				asm ("popfl");
 
+#endif
+
 
 
 typedef struct 
@@ -198,16 +889,64 @@ typedef struct
     unsigned short offset_16_31;
 } IDT;
 
+extern IDT idt[];
+
+void load_idt (IDT* base);
+
 #define CODE_SELECTOR 0x8
 #define DATA_SELECTOR 0x10
 #define MAX_INTERRUPTS 256
 #define IDT_ENTRY_SIZE 8
 
+/*
+ * CPU exceptions use vectors 0-31. The PIC lines IRQ 0-15 are mapped
+ * to vectors IRQ_BASE to IRQ_BASE+15.
+ */
+#define NUM_EXCEPTIONS	32
+#define IRQ_BASE	0x60
+#define NUM_IRQS	16
+#define IRQ(n)		(IRQ_BASE + (n))
+#define IS_IRQ(vec)	((vec) >= IRQ_BASE && (vec) < IRQ_BASE + NUM_IRQS)
+
+/*
+ * Stack frame passed to handle_exception()
+ */
+typedef struct {
+    unsigned edi, esi, ebp, ebx, edx, ecx, eax;
+    unsigned vector;
+    unsigned error_code;
+    unsigned eip, cs, eflags;
+} EXCEPTION_FRAME;
+
 
 extern BOOL interrupts_initialized;
+extern PROCESS interrupt_table[];
+
+typedef struct {
+    unsigned count;		/* interrupts since init_interrupts() */
+    unsigned missed;		/* arrived with nobody to serve them */
+    unsigned pending;		/* not yet returned by wait_for_interrupt() */
+    unsigned rate;		/* interrupts during the last second */
+    unsigned window_start;	/* timer tick the current second began */
+    unsigned window_count;
+} IRQ_STATS;
+
+extern IRQ_STATS irq_stats[];
+
+/*
+ * Which waiters an interrupt wakes up (set_irq_wake_mode())
+ */
+#define IRQ_WAKE_ONE	0
+#define IRQ_WAKE_ALL	1
 
 void init_idt_entry (int intr_no, void (*isr) (void));
-void wait_for_interrupt (int intr_no);
+void set_irq_handler (int intr_no, void (*handler) (int intr_no));
+void set_irq_tasklet (int intr_no, TASKLET* t);
+void set_irq_wake_mode (int intr_no, int mode);
+void remove_intr_waiter (PROCESS proc);
+int wait_for_interrupt (int intr_no);
+int wait_for_interrupt_timeout (int intr_no, unsigned ticks);
+void print_irq_stats (WINDOW* wnd);
 void init_interrupts ();
 
 
@@ -215,17 +954,56 @@ void init_interrupts ();
 
 #define TIMER_IRQ   0x60
 
+/*
+ * The PIT runs at its power-on divisor of 65536: 1193182 / 65536 = 18.2 Hz
+ */
+#define TIMER_HZ    18
+
 extern PORT timer_port;
 
+/*
+ * Request to the timer process: sleep num_of_ticks ticks, or with
+ * num_of_ticks == TIMER_UNTIL until timer_ticks reaches wake_tick
+ */
+#define TIMER_UNTIL	(-1)
+
 typedef struct _Timer_Message 
 {
     int num_of_ticks;
+    unsigned wake_tick;
 } Timer_Message;
 
+/*
+ * Timer that expires every period ticks, see wait_periodic_timer()
+ */
+typedef struct {
+    unsigned period;
+    unsigned next;		/* tick of the next expiry */
+    unsigned overruns;		/* expiries skipped because the owner was late */
+} PERIODIC_TIMER;
+
 void sleep(int num_of_ticks);
+void sleep_until(unsigned tick);
+void init_periodic_timer(PERIODIC_TIMER* t, unsigned period);
+int wait_periodic_timer(PERIODIC_TIMER* t);
 void init_timer();
 
 
+/*=====>>> timeout.c <<<====================================================*/
+
+/*
+ * Timeout value for the *_timeout() calls that means "wait forever"
+ */
+#define NO_TIMEOUT		0
+
+extern volatile unsigned timer_ticks;
+
+void add_timeout(PROCESS proc, unsigned ticks);
+void cancel_timeout(PROCESS proc);
+void timer_tick();
+void init_timeouts();
+
+
 /*=====>>> inout.c <<<======================================================*/
 
 unsigned char inportb (unsigned short port);
@@ -251,6 +1029,9 @@ typedef struct _COM_Message
 } COM_Message;
 
 void init_com();
+void init_dump_port();
+void dump_write(const void* buf, unsigned len);
+void dump_proc_names(unsigned len);
 
 
 /*=====>>> keyb.c <<<====================================================*/
@@ -3,6 +3,21 @@
 #define __STDARG_H__
 
 
+#ifdef TOS_HOST
+
+/*
+ * Host builds pass arguments following the calling convention of the
+ * build machine (in registers on x86-64), so use the compiler's own
+ * implementation.
+ */
+typedef __builtin_va_list va_list;
+
+#define va_start(AP, LASTARG)	__builtin_va_start(AP, LASTARG)
+#define va_end(AP)		__builtin_va_end(AP)
+#define va_arg(AP, TYPE)	__builtin_va_arg(AP, TYPE)
+
+#else
+
 typedef char *va_list;
 
 /* Amount of space required in an argument list for an arg of type TYPE.
@@ -21,3 +36,5 @@ typedef char *va_list;
   *((TYPE *) (AP - __va_rounded_size (TYPE))))
 
 #endif
+
+#endif
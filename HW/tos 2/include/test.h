@@ -65,13 +65,25 @@ void test_ipc_3();
 void test_ipc_4();
 void test_ipc_5();
 void test_ipc_6();
+void test_ipc_7();
 
 void test_isr_1();
 void test_isr_2();
 void test_isr_3();
+void test_isr_4();
+void test_isr_5();
+void test_isr_6();
 
 void test_timer_1();
+void test_timer_2();
 void test_com_1();
+void test_channel_1();
+void test_timeout_1();
+void test_timeout_2();
+void test_timeout_3();
+void test_sync_1();
+void test_edf_1();
+void test_fpu_1();
 void test_fork_1();
 
 #endif
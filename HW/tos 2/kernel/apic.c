@@ -0,0 +1,308 @@
+
+#include <kernel.h>
+
+/*
+ * Local APIC
+ *
+ * Every CPU has a local APIC at the same physical address; each CPU
+ * reaches its own through it. The registers are 32 bits wide, 16 bytes
+ * apart, and must be accessed with aligned 32-bit loads and stores.
+ * init_lapic() maps them into the MMIO window and enables the APIC of
+ * the boot CPU; the other CPUs call enable_lapic() when they start.
+ *
+ * Each local APIC has a timer. It counts down at the bus clock, which
+ * init_lapic() measures against the PIT, and is programmed to interrupt
+ * TIMER_HZ times a second on every CPU. That tick only drives
+ * preemption: the system time stays with the PIT, so there is a single
+ * timer_ticks no matter how many CPUs there are.
+ *
+ * I/O APIC
+ *
+ * With an I/O APIC, the device interrupts no longer go through the
+ * 8259s. Each ISA IRQ arrives on a pin of the I/O APIC (usually the
+ * pin of the same number; the MP table lists the exceptions, such as
+ * the PIT on pin 2), whose redirection entry names the vector and the
+ * CPU to deliver it to. init_ioapic() routes IRQ n to vector IRQ(n) on
+ * the boot CPU, so nothing changes for the drivers, and masks the
+ * 8259s. set_irq_cpu() sends a line to another CPU. Interrupts are then
+ * acknowledged at the local APIC of the CPU that took them rather than
+ * at the 8259. Without an I/O APIC the 8259s stay in charge.
+ */
+
+#define LAPIC_ID		0x020
+#define LAPIC_EOI		0x0B0
+#define LAPIC_SVR		0x0F0
+#define LAPIC_ESR		0x280
+#define LAPIC_ICR_LOW		0x300
+#define LAPIC_ICR_HIGH		0x310
+#define LAPIC_LVT_TIMER		0x320
+#define LAPIC_TIMER_INIT	0x380
+#define LAPIC_TIMER_CURRENT	0x390
+#define LAPIC_TIMER_DIVIDE	0x3E0
+
+#define LAPIC_SVR_ENABLE	0x100
+
+#define ICR_DELIVERY_PENDING	0x1000
+
+#define LVT_MASKED		0x10000
+#define LVT_TIMER_PERIODIC	0x20000
+#define TIMER_DIVIDE_16		0x3
+
+#define IOAPIC_REGSEL		0x00
+#define IOAPIC_WINDOW		0x10
+#define IOAPIC_VERSION		0x01
+#define IOAPIC_REDIRECTION(pin)	(0x10 + 2 * (pin))
+
+/* redirection entry, low word; delivery mode fixed, physical destination */
+#define REDIRECT_ACTIVE_LOW	0x2000
+#define REDIRECT_LEVEL		0x8000
+#define REDIRECT_MASKED		0x10000
+
+/* the 8259 line the slave controller cascades into */
+#define CASCADE_IRQ		2
+
+/* linear address of the registers, 0 if there is no local APIC */
+MEM_ADDR lapic_base = 0;
+
+/* TRUE once the I/O APIC delivers the device interrupts */
+BOOL ioapic_enabled = FALSE;
+
+static MEM_ADDR ioapic_base;
+static int ioapic_pins;
+
+/* initial count of the local APIC timer for one tick, 0 if unknown */
+static LONG lapic_timer_count = 0;
+
+/* I/O APIC pin, redirection flags and CPU of each ISA IRQ */
+static int irq_pin[NUM_IRQS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+static unsigned irq_flags[NUM_IRQS];
+static int irq_dest[NUM_IRQS];
+
+
+static LONG lapic_read(unsigned reg)
+{
+    return *(volatile LONG*) (lapic_base + reg);
+}
+
+static void lapic_write(unsigned reg, LONG value)
+{
+    *(volatile LONG*) (lapic_base + reg) = value;
+}
+
+
+/*
+ * Enables the local APIC of the calling CPU
+ */
+void enable_lapic()
+{
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    /* the error status register is cleared by back-to-back writes */
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+}
+
+
+/*
+ * APIC ID of the calling CPU
+ */
+int lapic_id()
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+
+/*
+ * Sends an inter-processor interrupt with the given ICR command bits
+ * to the CPU with the given APIC ID and waits until it is delivered.
+ */
+void lapic_send_ipi(int apic_id, unsigned command)
+{
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING)
+	;
+    ENABLE_INTR(saved_if);
+}
+
+
+void lapic_eoi()
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+
+/*
+ * Measures how far the local APIC timer counts down in one PIT tick.
+ * Needs the PIT interrupt, so interrupts must be on.
+ */
+static void calibrate_lapic_timer()
+{
+    unsigned start;
+
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    /* start right after a tick, then count until the next one */
+    start = timer_ticks;
+    while (timer_ticks == start)
+	;
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    start = timer_ticks;
+    while (timer_ticks == start)
+	;
+    lapic_timer_count = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+/*
+ * Starts the periodic local APIC timer of the calling CPU. All CPUs
+ * share the bus clock, so the count measured on the boot CPU holds for
+ * every one of them.
+ */
+void start_lapic_timer()
+{
+    if (lapic_timer_count == 0)
+	return;
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+/*
+ * Called by irq_dispatch() for LAPIC_TIMER_VECTOR. The interrupt only
+ * gives the dispatcher a chance to preempt the running process.
+ */
+void lapic_timer_irq()
+{
+    this_cpu()->local_ticks++;
+    lapic_eoi();
+}
+
+
+/*
+ * Busy-waits for about usecs microseconds. A write to the POST code
+ * port 0x80 takes about a microsecond on the ISA bus.
+ */
+void udelay(unsigned usecs)
+{
+    while (usecs--)
+	outportb(0x80, 0);
+}
+
+
+/*
+ * Maps the local APIC registers found at phys and enables the APIC of
+ * the boot CPU. Returns FALSE if the CPU has no local APIC.
+ */
+BOOL init_lapic(MEM_ADDR phys)
+{
+    if (!(cpu_features() & CPU_FEATURE_APIC))
+	return FALSE;
+    lapic_base = map_mmio(phys, PAGE_SIZE);
+    enable_lapic();
+    calibrate_lapic_timer();
+    return TRUE;
+}
+
+
+static LONG ioapic_read(unsigned reg)
+{
+    *(volatile LONG*) (ioapic_base + IOAPIC_REGSEL) = reg;
+    return *(volatile LONG*) (ioapic_base + IOAPIC_WINDOW);
+}
+
+static void ioapic_write(unsigned reg, LONG value)
+{
+    *(volatile LONG*) (ioapic_base + IOAPIC_REGSEL) = reg;
+    *(volatile LONG*) (ioapic_base + IOAPIC_WINDOW) = value;
+}
+
+/* writes the redirection entry of ISA IRQ irq */
+static void route_irq(int irq)
+{
+    int pin = irq_pin[irq];
+
+    /* the destination first, so the entry never points at a wrong CPU */
+    ioapic_write(IOAPIC_REDIRECTION(pin), REDIRECT_MASKED);
+    ioapic_write(IOAPIC_REDIRECTION(pin) + 1,
+		 cpus[irq_dest[irq]].apic_id << 24);
+    ioapic_write(IOAPIC_REDIRECTION(pin), irq_flags[irq] | IRQ(irq));
+}
+
+
+/*
+ * Records that ISA IRQ irq is wired to I/O APIC pin pin, and how it is
+ * signalled. ISA interrupts are edge triggered and active high unless
+ * the MP table says otherwise. Must be called before init_ioapic().
+ */
+void set_isa_irq_pin(int irq, int pin, BOOL active_low, BOOL level)
+{
+    assert(irq >= 0 && irq < NUM_IRQS);
+    irq_pin[irq] = pin;
+    irq_flags[irq] = (active_low ? REDIRECT_ACTIVE_LOW : 0) |
+		     (level ? REDIRECT_LEVEL : 0);
+}
+
+
+/*
+ * Maps the I/O APIC registers at phys, routes the ISA interrupts
+ * through it to the boot CPU and masks the 8259s.
+ */
+void init_ioapic(MEM_ADDR phys)
+{
+    volatile int saved_if;
+    int irq, pin;
+
+    if (lapic_base == 0)
+	return;
+    ioapic_base = map_mmio(phys, PAGE_SIZE);
+    ioapic_pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+
+    DISABLE_INTR(saved_if);
+    for (pin = 0; pin < ioapic_pins; pin++)
+	ioapic_write(IOAPIC_REDIRECTION(pin), REDIRECT_MASKED);
+    for (irq = 0; irq < NUM_IRQS; irq++) {
+	irq_dest[irq] = BOOT_CPU;
+	/* IRQ 2 only exists on the 8259s; its pin may carry IRQ 0 */
+	if (irq != CASCADE_IRQ && irq_pin[irq] < ioapic_pins)
+	    route_irq(irq);
+    }
+    /* the 8259s stay programmed, just silent */
+    outportb(0x21, 0xFF);
+    outportb(0xA1, 0xFF);
+    ioapic_enabled = TRUE;
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Delivers the interrupt intr_no to CPU cpu from now on. Processes
+ * waiting for it may run anywhere, but a driver's notifier is best
+ * pinned to the CPU its interrupt arrives on (see irq_cpu()). Without
+ * an I/O APIC every interrupt goes to the boot CPU.
+ */
+void set_irq_cpu(int intr_no, int cpu)
+{
+    volatile int saved_if;
+    int irq = intr_no - IRQ_BASE;
+
+    assert(IS_IRQ(intr_no) && cpu >= 0 && cpu < num_cpus);
+    if (!ioapic_enabled)
+	return;
+    DISABLE_INTR(saved_if);
+    irq_dest[irq] = cpu;
+    if (irq != CASCADE_IRQ && irq_pin[irq] < ioapic_pins)
+	route_irq(irq);
+    ENABLE_INTR(saved_if);
+}
+
+/* the CPU that takes the interrupt intr_no */
+int irq_cpu(int intr_no)
+{
+    assert(IS_IRQ(intr_no));
+    return ioapic_enabled ? irq_dest[intr_no - IRQ_BASE] : BOOT_CPU;
+}
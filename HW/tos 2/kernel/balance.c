@@ -0,0 +1,210 @@
+
+#include <kernel.h>
+
+/*
+ * Load balancing between the per-CPU ready queues
+ *
+ * Processes are placed on the least loaded CPU when they are created,
+ * but what they do afterwards is not known then. Two mechanisms move
+ * ready processes between CPUs later:
+ *
+ * - An idle CPU steals from the busiest peer (steal_work(), called by
+ *   the idle processes).
+ * - Every BALANCE_INTERVAL ticks the timer interrupt moves a process
+ *   from the busiest to the least busy CPU if they differ by two or
+ *   more (balance_cpus()). It also moves processes that are on a CPU
+ *   their affinity mask no longer allows.
+ *
+ * A process is only moved to a CPU whose ready queue has nothing at a
+ * higher priority, since it would only wait there instead. Of the
+ * candidates, the one that would run last on its old CPU is taken; it
+ * is the least likely to still have its data in that CPU's cache.
+ *
+ * Processes are moved with the kernel lock held. Every CPU holds it
+ * from the moment it saves the context of a process until it runs on
+ * the stack of the next one, so a process that is not cpus[n].current
+ * anywhere is not in use by any CPU and can be moved safely.
+ */
+
+#define BALANCE_INTERVAL	(TIMER_HZ / 4)
+#define STEAL_BACKOFF		1000	/* pause loops after a failed steal */
+
+
+/* is proc a ready process of src that may move to CPU dst? */
+static BOOL movable(CPU_DEF* src, PROCESS proc, int dst)
+{
+    return proc != src->current && proc != src->idle &&
+	   (proc->affinity & CPU_MASK(dst));
+}
+
+/*
+ * Returns a process of src's ready queue that can move to dst, at
+ * priority min_prio or higher, or NULL. Called with the kernel lock.
+ */
+static PROCESS find_movable(CPU_DEF* src, int dst, int min_prio)
+{
+    PROCESS first, p, found = NULL;
+    int prio;
+    volatile int saved_if;
+
+    spin_lock_irqsave(&src->lock, saved_if);
+    for (prio = MAX_READY_QUEUES - 1; prio >= min_prio && found == NULL; prio--) {
+	if ((first = src->run_queue[prio]) == NULL)
+	    continue;
+	/* from the tail: the process that would run last */
+	p = first;
+	do {
+	    p = p->prev;
+	    if (movable(src, p, dst))
+		found = p;
+	} while (found == NULL && p != first);
+    }
+    spin_unlock_irqrestore(&src->lock, saved_if);
+    return found;
+}
+
+/* moves the ready process proc to the ready queue of cpu */
+static void move_process(PROCESS proc, int cpu)
+{
+    remove_ready_queue(proc);
+    proc->cpu = cpu;
+    add_ready_queue(proc);
+    cpus[cpu].migrations++;
+}
+
+/* moves one process from src to dst if it is worth it */
+static BOOL balance_pair(CPU_DEF* src, CPU_DEF* dst)
+{
+    PROCESS proc;
+
+    proc = find_movable(src, dst->id,
+			get_highest_priority(dst->run_queue_state));
+    if (proc == NULL)
+	return FALSE;
+    move_process(proc, dst->id);
+    return TRUE;
+}
+
+/* the online CPU other than self with the most ready processes, or NULL */
+static CPU_DEF* busiest_cpu(CPU_DEF* self)
+{
+    CPU_DEF* busiest = NULL;
+    int i;
+
+    for (i = 0; i < num_cpus; i++)
+	if (cpus[i].online && &cpus[i] != self &&
+	    (busiest == NULL || cpus[i].nr_ready > busiest->nr_ready))
+	    busiest = &cpus[i];
+    return busiest;
+}
+
+
+/*
+ * Called by the idle process of a CPU with nothing else to run. Moves
+ * a process from the busiest peer to this CPU and returns TRUE, or
+ * returns FALSE after a short pause, so that idle CPUs do not hammer
+ * the kernel lock.
+ */
+BOOL steal_work()
+{
+    CPU_DEF* self = this_cpu();
+    CPU_DEF* busiest;
+    BOOL stolen = FALSE;
+    volatile int saved_if;
+    int i;
+
+    /*
+     * A peer has something to spare if it has more than its idle
+     * process and the one it runs. The count is only a hint here.
+     */
+    busiest = busiest_cpu(self);
+    if (busiest != NULL && busiest->nr_ready > 2) {
+	DISABLE_INTR(saved_if);
+	stolen = balance_pair(busiest, self);
+	ENABLE_INTR(saved_if);
+    }
+    if (!stolen)
+	for (i = 0; i < STEAL_BACKOFF; i++)
+	    asm volatile ("rep; nop");
+    return stolen;
+}
+
+
+/*
+ * Called from the timer interrupt with the kernel lock held
+ */
+void balance_cpus()
+{
+    CPU_DEF* busiest = NULL;
+    CPU_DEF* idlest = NULL;
+    PROCESS p;
+    int i, cpu;
+
+    if (num_cpus == 1 || timer_ticks % BALANCE_INTERVAL != 0)
+	return;
+
+    /* processes left on a CPU their affinity does not allow */
+    for (i = 0, p = pcb; i < MAX_PROCS; i++, p++) {
+	if (!p->used || p->state != STATE_READY ||
+	    (p->affinity & CPU_MASK(p->cpu)) ||
+	    p == cpus[p->cpu].current)
+	    continue;
+	if ((cpu = pick_cpu(p->affinity)) >= 0)
+	    move_process(p, cpu);
+    }
+
+    for (i = 0; i < num_cpus; i++) {
+	if (!cpus[i].online)
+	    continue;
+	if (busiest == NULL || cpus[i].nr_ready > busiest->nr_ready)
+	    busiest = &cpus[i];
+	if (idlest == NULL || cpus[i].nr_ready < idlest->nr_ready)
+	    idlest = &cpus[i];
+    }
+    if (busiest->nr_ready - idlest->nr_ready >= 2)
+	balance_pair(busiest, idlest);
+}
+
+
+/*
+ * Restricts proc to the CPUs in mask. If it is on another CPU, it is
+ * moved right away unless it is running there at the moment; then the
+ * next balance_cpus() moves it. A process may change its own affinity.
+ */
+void set_affinity(PROCESS proc, unsigned mask)
+{
+    volatile int saved_if;
+    int cpu;
+
+    DISABLE_INTR(saved_if);
+    proc->affinity = mask;
+    if (!(mask & CPU_MASK(proc->cpu)) && (cpu = pick_cpu(mask)) >= 0) {
+	if (proc->state != STATE_READY)
+	    /* blocked: it wakes up on the new CPU */
+	    proc->cpu = cpu;
+	else if (proc == active_proc) {
+	    move_process(proc, cpu);
+	    resign();
+	} else if (proc != cpus[proc->cpu].current)
+	    move_process(proc, cpu);
+    }
+    ENABLE_INTR(saved_if);
+}
+
+
+void print_cpus(WINDOW* wnd)
+{
+    CPU_DEF* cpu;
+    int i;
+
+    wprintf(wnd, "CPU  APIC  Ready  Moved in  Ticks     Running               FPU\n");
+    for (i = 0; i < num_cpus; i++) {
+	cpu = &cpus[i];
+	if (!cpu->online)
+	    continue;
+	wprintf(wnd, "%-3d  %-4d  %-5d  %-8d  %-8d  %-20s  %s\n", i,
+		cpu->apic_id, cpu->nr_ready, cpu->migrations, cpu->local_ticks,
+		cpu->current != NULL ? cpu->current->name : "-",
+		cpu->fpu_owner != NULL ? cpu->fpu_owner->name : "-");
+    }
+}
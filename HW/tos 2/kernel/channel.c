@@ -0,0 +1,244 @@
+
+#include <kernel.h>
+
+/*
+ * Single-producer/single-consumer ring channels
+ *
+ * A channel is a ring of num_items fixed-size items in kernel heap
+ * memory. head is only advanced by the producer and tail only by the
+ * consumer, so the data path needs no lock: an item is written before
+ * head is advanced past it and read before tail is advanced past it.
+ * x86 does not reorder stores with other stores, so a compiler barrier
+ * is enough to keep the order.
+ *
+ * A process only blocks when the ring is full (producer) or empty
+ * (consumer). It sets its waiting flag, checks the ring again and only
+ * then leaves the ready queue, all with interrupts disabled; the other
+ * end advances its index and then checks the flag to wake it up. With
+ * the two ends on different CPUs, each side's store must be visible
+ * before its load, so both sides put a full fence (smp_mb()) between
+ * them; otherwise both could read the old values and the wakeup would
+ * be lost. Blocked processes are in STATE_CHANNEL_BLOCKED rather than
+ * receive blocked on a port, so that a wakeup can never be mistaken
+ * for, or swallow, a message sent to one of their ports.
+ */
+
+#define barrier()	asm volatile ("" : : : "memory")
+
+CHANNEL_DEF channel[MAX_CHANNELS];
+CHANNEL next_free_channel;
+
+
+static void check_valid_channel(CHANNEL ch)
+{
+    assert(ch->magic == MAGIC_CHANNEL && ch->used);
+}
+
+static void* item_addr(CHANNEL ch, unsigned index)
+{
+    return ch->buffer + (index & (ch->num_items - 1)) * ch->item_size;
+}
+
+/* wake the process waiting at one end of the channel, if any */
+static void wake_up(volatile BOOL* waiting, PROCESS proc)
+{
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    if (*waiting) {
+	*waiting = FALSE;
+	add_ready_queue(proc);
+    }
+    ENABLE_INTR(saved_if);
+}
+
+/* block the calling process until its waiting flag is cleared by the other end */
+static void block()
+{
+    active_proc->state = STATE_CHANNEL_BLOCKED;
+    remove_ready_queue(active_proc);
+    resign();
+}
+
+
+/*
+ * Creates a channel holding num_items items of item_size bytes each.
+ * num_items is rounded up to a power of two. Returns NULL if no
+ * channel or no memory is available.
+ */
+CHANNEL create_channel(int num_items, int item_size)
+{
+    CHANNEL ch;
+    unsigned n;
+    volatile int saved_if;
+
+    assert(num_items > 0 && item_size > 0);
+    for (n = 1; n < num_items; n <<= 1)
+	;
+
+    DISABLE_INTR(saved_if);
+    ch = next_free_channel;
+    if (ch != NULL)
+	next_free_channel = ch->next;
+    ENABLE_INTR(saved_if);
+    if (ch == NULL)
+	return NULL;
+
+    ch->buffer = k_malloc(n * item_size);
+    if (ch->buffer == NULL) {
+	DISABLE_INTR(saved_if);
+	ch->next = next_free_channel;
+	next_free_channel = ch;
+	ENABLE_INTR(saved_if);
+	return NULL;
+    }
+    ch->used = TRUE;
+    ch->head = 0;
+    ch->tail = 0;
+    ch->num_items = n;
+    ch->item_size = item_size;
+    ch->producer = NULL;
+    ch->consumer = NULL;
+    ch->producer_waiting = FALSE;
+    ch->consumer_waiting = FALSE;
+    return ch;
+}
+
+
+/*
+ * Attaches the calling process to one end of a channel
+ * (CHANNEL_PRODUCER or CHANNEL_CONSUMER).
+ */
+void attach_channel(CHANNEL ch, int end)
+{
+    check_valid_channel(ch);
+    if (end == CHANNEL_PRODUCER) {
+	assert(ch->producer == NULL);
+	ch->producer = active_proc;
+    } else {
+	assert(end == CHANNEL_CONSUMER && ch->consumer == NULL);
+	ch->consumer = active_proc;
+    }
+}
+
+
+/*
+ * Releases a channel. No process may be blocked on it.
+ */
+void destroy_channel(CHANNEL ch)
+{
+    volatile int saved_if;
+
+    check_valid_channel(ch);
+    assert(!ch->producer_waiting && !ch->consumer_waiting);
+    k_free(ch->buffer);
+    DISABLE_INTR(saved_if);
+    ch->used = FALSE;
+    ch->next = next_free_channel;
+    next_free_channel = ch;
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Appends an item without blocking. Returns FALSE if the ring is full.
+ */
+BOOL channel_try_write(CHANNEL ch, const void* item)
+{
+    unsigned head = ch->head;
+
+    if (head - ch->tail == ch->num_items)
+	return FALSE;
+    k_memcpy(item_addr(ch, head), item, ch->item_size);
+    barrier();
+    ch->head = head + 1;
+    smp_mb();
+    if (ch->consumer_waiting)
+	wake_up(&ch->consumer_waiting, ch->consumer);
+    return TRUE;
+}
+
+
+/*
+ * Removes the oldest item without blocking. Returns FALSE if the
+ * ring is empty.
+ */
+BOOL channel_try_read(CHANNEL ch, void* item)
+{
+    unsigned tail = ch->tail;
+
+    if (ch->head == tail)
+	return FALSE;
+    k_memcpy(item, item_addr(ch, tail), ch->item_size);
+    barrier();
+    ch->tail = tail + 1;
+    smp_mb();
+    if (ch->producer_waiting)
+	wake_up(&ch->producer_waiting, ch->producer);
+    return TRUE;
+}
+
+
+/*
+ * Appends an item, blocking while the ring is full.
+ */
+void channel_write(CHANNEL ch, const void* item)
+{
+    volatile int saved_if;
+
+    assert(ch->producer == active_proc);
+    while (!channel_try_write(ch, item)) {
+	DISABLE_INTR(saved_if);
+	ch->producer_waiting = TRUE;
+	smp_mb();
+	/* the consumer may have made room in the meantime */
+	if (ch->head - ch->tail == ch->num_items)
+	    block();
+	else
+	    ch->producer_waiting = FALSE;
+	ENABLE_INTR(saved_if);
+    }
+}
+
+
+/*
+ * Removes the oldest item, blocking while the ring is empty.
+ */
+void channel_read(CHANNEL ch, void* item)
+{
+    volatile int saved_if;
+
+    assert(ch->consumer == active_proc);
+    while (!channel_try_read(ch, item)) {
+	DISABLE_INTR(saved_if);
+	ch->consumer_waiting = TRUE;
+	smp_mb();
+	if (ch->head == ch->tail)
+	    block();
+	else
+	    ch->consumer_waiting = FALSE;
+	ENABLE_INTR(saved_if);
+    }
+}
+
+
+/*
+ * Number of items currently in the ring
+ */
+int channel_count(CHANNEL ch)
+{
+    return ch->head - ch->tail;
+}
+
+
+void init_channels()
+{
+    int i;
+
+    for (i = 0; i < MAX_CHANNELS; i++) {
+	channel[i].magic = MAGIC_CHANNEL;
+	channel[i].used = FALSE;
+	channel[i].next = (i < MAX_CHANNELS - 1) ? &channel[i + 1] : NULL;
+    }
+    next_free_channel = channel;
+}
@@ -35,3 +35,59 @@ void init_uart()
 void init_com ()
 {
 }
+
+
+/*
+ * COM2 carries the dumps of the trace and the profiler. It is driven
+ * by polling at 115200 baud, so it works with interrupts off and does
+ * not disturb COM1.
+ */
+#define DUMP_BAUD_DIVISOR	1		/* 115200 baud */
+
+void init_dump_port()
+{
+    /* LineControl disabled to set baud rate */
+    outportb (COM2_PORT + 3, 0x80);
+    outportb (COM2_PORT + 0, DUMP_BAUD_DIVISOR);
+    outportb (COM2_PORT + 1, 0);
+    /* 8 Bits, No Parity, 1 stop bit */
+    outportb (COM2_PORT + 3, 0x03);
+    /* Interrupt disable */
+    outportb (COM2_PORT + 1, 0);
+    /* DTR and RTS, no interrupt line */
+    outportb (COM2_PORT + 4, 0x03);
+}
+
+void dump_write(const void* buf, unsigned len)
+{
+    const BYTE* p = buf;
+
+    while (len--) {
+	/* wait until the transmitter holding register is empty */
+	while (!(inportb(COM2_PORT + 5) & (1 << 5)))
+	    ;
+	outportb(COM2_PORT, *p++);
+    }
+}
+
+/*
+ * Sends the name of every PCB slot, '\0'-padded to len bytes and cut
+ * to len - 1 characters. Free slots get an empty name.
+ */
+void dump_proc_names(unsigned len)
+{
+    static const char zero = '\0';
+    unsigned i, n;
+
+    for (i = 0; i < MAX_PROCS; i++) {
+	n = 0;
+	if (pcb[i].used && pcb[i].magic == MAGIC_PCB && pcb[i].name != NULL) {
+	    n = k_strlen(pcb[i].name);
+	    if (n > len - 1)
+		n = len - 1;
+	    dump_write(pcb[i].name, n);
+	}
+	for (; n < len; n++)
+	    dump_write(&zero, 1);
+    }
+}
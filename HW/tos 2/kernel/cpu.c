@@ -0,0 +1,77 @@
+
+#include <kernel.h>
+
+#define EFLAGS_ID	0x200000
+
+
+/*
+ * Returns TRUE if the CPU supports the CPUID instruction. This is the
+ * case if the ID flag in EFLAGS can be toggled (i486 and later).
+ */
+BOOL has_cpuid()
+{
+    unsigned long flags, saved_flags;
+
+    asm volatile ("pushf\n\t"
+		  "pop %0\n\t"
+		  "mov %0,%1\n\t"
+		  "xor %2,%0\n\t"
+		  "push %0\n\t"
+		  "popf\n\t"
+		  "pushf\n\t"
+		  "pop %0\n\t"
+		  "push %1\n\t"
+		  "popf"
+		  : "=&r" (flags), "=&r" (saved_flags)
+		  : "i" (EFLAGS_ID)
+		  : "cc");
+    return ((flags ^ saved_flags) & EFLAGS_ID) != 0;
+}
+
+
+/*
+ * Executes CPUID for the given leaf. Any of the output pointers may
+ * be NULL.
+ */
+void cpuid(unsigned leaf, unsigned* eax, unsigned* ebx,
+	   unsigned* ecx, unsigned* edx)
+{
+    unsigned a, b, c, d;
+
+    asm volatile ("cpuid"
+		  : "=a" (a), "=b" (b), "=c" (c), "=d" (d)
+		  : "a" (leaf), "c" (0));
+    if (eax != NULL) *eax = a;
+    if (ebx != NULL) *ebx = b;
+    if (ecx != NULL) *ecx = c;
+    if (edx != NULL) *edx = d;
+}
+
+
+/*
+ * Returns the low 32 bits of the time-stamp counter. Differences are
+ * valid for intervals of up to 2^32 cycles. Callers must check for
+ * CPU_FEATURE_TSC.
+ */
+unsigned read_tsc()
+{
+    unsigned lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+
+/*
+ * Returns the feature flags (EDX of CPUID leaf 1), or 0 if the CPU
+ * does not support CPUID.
+ */
+unsigned cpu_features()
+{
+    unsigned features;
+
+    if (!has_cpuid())
+	return 0;
+    cpuid(1, NULL, NULL, NULL, &features);
+    return features;
+}
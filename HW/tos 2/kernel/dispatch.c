@@ -4,23 +4,118 @@
 #include "disptable.c"
 
 /*
- * process that currently owns the CPU.
+ * Per-CPU scheduler state. Every CPU has its own process that currently
+ * owns it (active_proc) and its own ready queues for all eight
+ * priorities (MAX_READY_QUEUES = 8); the same priority processes on a
+ * ready queue are organized as a doubly linked list. run_queue_state
+ * (ready_lists_state) has a bit set for each non-empty list.
+ *
+ * A process is on the ready queue of the CPU given by proc->cpu. The
+ * queue is protected by that CPU's spinlock, so another CPU can make a
+ * process ready without holding the kernel lock.
+ *
+ * EDF processes with budget left are kept apart on edf_queue, a
+ * doubly linked list sorted by deadline.
  */
-PROCESS active_proc;
-
+CPU_DEF cpus[MAX_CPUS];
 
 /*
- * Ready queues for all eight priorities.
- * MAX_READY_QUEUES	= 8
- * the same priority processes on the ready queue are organized as a doubly linked list
+ * CPUs found at boot; cpus[i].online tells which of them are running
  */
-PCB *ready_queue [MAX_READY_QUEUES];
+int num_cpus = 1;
+
+
+/* TRUE if proc goes on the EDF queue rather than a priority queue */
+static BOOL on_edf_queue(PROCESS proc)
+{
+	return proc->edf_left != 0;
+}
 
 /*
- * the state (empty or not) of process lists for all priorities (on the ready queue).
- * use bit patterns to indicate state (empty or not)
+ * Links proc into the ready queue of cpu: at the tail of its priority
+ * level, or into the EDF queue by deadline. Called with cpu->lock.
  */
-unsigned ready_lists_state;
+static void enqueue(CPU_DEF* cpu, PROCESS proc)
+{
+	unsigned short current_priority;
+	PROCESS p;
+
+	if (on_edf_queue(proc)) {
+		p = cpu->edf_queue;
+		if (p == NULL) {
+			cpu->edf_queue = proc;
+			proc->next = proc;
+			proc->prev = proc;
+		} else {
+			/* after every process whose deadline is not later */
+			while ((int) (p->edf_deadline - proc->edf_deadline) <= 0 &&
+			       (p = p->next) != cpu->edf_queue)
+				;
+			proc->next = p;
+			proc->prev = p->prev;
+			p->prev->next = proc;
+			p->prev = proc;
+			if (p == cpu->edf_queue &&
+			    (int) (proc->edf_deadline - p->edf_deadline) < 0)
+				cpu->edf_queue = proc;
+		}
+		cpu->nr_ready++;
+		return;
+	}
+
+	current_priority = proc->priority;
+	if (cpu->run_queue[current_priority] == NULL) {
+		// if empty at this priority
+		cpu->run_queue[current_priority] = proc;
+    	proc->next = proc;
+    	proc->prev = proc;
+    	cpu->run_queue_state |= 1 << current_priority; // set the corresponding bit to 1
+	} else {
+        // add to the tail
+    	proc->prev = cpu->run_queue[current_priority]->prev;
+        proc->next = cpu->run_queue[current_priority];
+        cpu->run_queue[current_priority]->prev->next = proc;
+        cpu->run_queue[current_priority]->prev = proc;
+    }
+    cpu->nr_ready++;
+}
+
+/* unlinks proc from the ready queue of cpu; called with cpu->lock */
+static void dequeue(CPU_DEF* cpu, PROCESS proc)
+{
+	unsigned short current_priority;
+
+	if (on_edf_queue(proc)) {
+		if (proc->next == proc)
+			cpu->edf_queue = NULL;
+		else {
+			if (cpu->edf_queue == proc)
+				cpu->edf_queue = proc->next;
+			proc->prev->next = proc->next;
+			proc->next->prev = proc->prev;
+		}
+		cpu->nr_ready--;
+		return;
+	}
+
+	current_priority = proc->priority;
+	if (proc->next == proc) {
+		// the only process at this priority
+		cpu->run_queue[current_priority] = NULL;
+	    cpu->run_queue_state &= ~(1 << current_priority);
+	}
+	else {
+		if (cpu->run_queue[current_priority] == proc)
+			cpu->run_queue[current_priority] = proc->next;
+		proc->prev->next = proc->next;
+		proc->next->prev = proc->prev;
+	}
+	cpu->nr_ready--;
+
+	// cannot have code below since the implementaion is not a real round-robin
+	// proc->prev = NULL;
+	// proc->next = NULL;
+}
 
 
 /*
@@ -39,28 +134,17 @@ unsigned ready_lists_state;
 
 void add_ready_queue (PROCESS proc)
 {
-	unsigned short current_priority;
+	CPU_DEF* cpu;
 	volatile int saved_if;
 
-	DISABLE_INTR(saved_if);
 	assert (proc->magic == MAGIC_PCB);
-	current_priority = proc->priority;
-
-	if (ready_queue[current_priority] == NULL) {
-		// if empty at this priority
-		ready_queue[current_priority] = proc;
-    	proc->next = proc;
-    	proc->prev = proc;
-    	ready_lists_state |= 1 << current_priority; // set the corresponding bit to 1
-	} else {
-        // add to the tail
-    	proc->prev = ready_queue[current_priority]->prev;
-        proc->next = ready_queue[current_priority];
-        ready_queue[current_priority]->prev->next = proc;
-        ready_queue[current_priority]->prev = proc;
-    }
-    proc->state = STATE_READY;
-    ENABLE_INTR(saved_if);
+	cpu = &cpus[proc->cpu];
+	spin_lock_irqsave(&cpu->lock, saved_if);
+	enqueue(cpu, proc);
+	if (proc->state != STATE_READY)
+		TRACE(TRACE_STATE, proc, STATE_READY);
+	proc->state = STATE_READY;
+	spin_unlock_irqrestore(&cpu->lock, saved_if);
 }
 
 
@@ -82,29 +166,45 @@ void add_ready_queue (PROCESS proc)
 
 void remove_ready_queue (PROCESS proc)
 {
-	unsigned short current_priority;
+	CPU_DEF* cpu;
 	volatile int saved_if;
 
-	DISABLE_INTR(saved_if);
 	assert (proc->magic == MAGIC_PCB);
-	current_priority = proc->priority;
+	cpu = &cpus[proc->cpu];
+	spin_lock_irqsave(&cpu->lock, saved_if);
+	dequeue(cpu, proc);
+	/* a process that blocks has set its new state already */
+	if (proc->state != STATE_READY)
+		TRACE(TRACE_STATE, proc, proc->state);
+	spin_unlock_irqrestore(&cpu->lock, saved_if);
+}
 
-	if (proc->next == proc) {
-		// the only process at this priority
-		ready_queue[current_priority] = NULL;
-	    ready_lists_state &= ~(1 << current_priority);
-	}
-	else {
-		if (ready_queue[current_priority] == proc)
-			ready_queue[current_priority] = proc->next;
-		proc->prev->next = proc->next;
-		proc->next->prev = proc->prev;
-	}
-	ENABLE_INTR(saved_if);
 
-	// cannot have code below since the implementaion is not a real round-robin
-	// proc->prev = NULL;
-	// proc->next = NULL;
+/*
+ * set_edf_budget
+ *----------------------------------------------------------------------------
+ * Sets the budget left and the deadline of proc (see edf.c). Whether
+ * a process is on the EDF queue or on a priority queue depends on
+ * them, so a ready process is taken off its queue and put back.
+ */
+
+void set_edf_budget (PROCESS proc, unsigned left, unsigned deadline)
+{
+	CPU_DEF* cpu;
+	volatile int saved_if;
+	BOOL queued;
+
+	assert (proc->magic == MAGIC_PCB);
+	cpu = &cpus[proc->cpu];
+	spin_lock_irqsave(&cpu->lock, saved_if);
+	queued = proc->state == STATE_READY;
+	if (queued)
+		dequeue(cpu, proc);
+	proc->edf_left = left;
+	proc->edf_deadline = deadline;
+	if (queued)
+		enqueue(cpu, proc);
+	spin_unlock_irqrestore(&cpu->lock, saved_if);
 }
 
 /*
@@ -127,7 +227,9 @@ int get_highest_priority(unsigned value)
 /*
  * dispatcher
  *----------------------------------------------------------------------------
- * Determines a new process to be dispatched. The process
+ * Determines a new process to be dispatched. Processes of the
+ * EDF class (see edf.c) come before all priority levels; of them the
+ * one with the earliest deadline is taken. Otherwise the process
  * with the highest priority is taken. Within one priority
  * level round robin is used.
  *
@@ -141,21 +243,59 @@ int get_highest_priority(unsigned value)
 PROCESS dispatcher()
 {
 	int current_priority, highest_priority;
+	CPU_DEF* cpu = this_cpu();
 	volatile int saved_if;
 	PROCESS candidate;
 
-	DISABLE_INTR(saved_if);
-	current_priority = active_proc->priority;
-	highest_priority = get_highest_priority(ready_lists_state);
-	assert((highest_priority >= 0) && (highest_priority <= 7));
-	if(highest_priority == current_priority)
-		candidate = active_proc->next;
-	else
-		candidate = ready_queue[highest_priority];
-	ENABLE_INTR(saved_if);
+	spin_lock_irqsave(&cpu->lock, saved_if);
+	if (cpu->edf_queue != NULL) {
+		/* real-time processes first, the earliest deadline first */
+		candidate = cpu->edf_queue;
+	} else {
+		current_priority = cpu->current->priority;
+		highest_priority = get_highest_priority(cpu->run_queue_state);
+		assert((highest_priority >= 0) && (highest_priority <= 7));
+		/*
+		 * unless active_proc has just moved to the queue of another
+		 * CPU, or its next link is one of the EDF queue
+		 */
+		if(highest_priority == current_priority &&
+		   cpu->current->cpu == cpu->id && !on_edf_queue(cpu->current))
+			candidate = cpu->current->next;
+		else
+			candidate = cpu->run_queue[highest_priority];
+	}
+	spin_unlock_irqrestore(&cpu->lock, saved_if);
+	if (candidate != cpu->current)
+		TRACE(TRACE_SWITCH, candidate, cpu->current - pcb);
 	return candidate;
 }
 
+
+/*
+ * pick_cpu
+ *----------------------------------------------------------------------------
+ * Returns the online CPU in mask with the fewest ready processes,
+ * preferring the calling CPU, or -1 if mask has no online CPU. Used to
+ * place processes. The counts are read without locks; the answer only
+ * needs to be roughly right.
+ */
+
+int pick_cpu(unsigned mask)
+{
+	int i, best = -1;
+
+	if (mask & CPU_MASK(this_cpu()->id))
+		best = this_cpu()->id;
+	for (i = 0; i < num_cpus; i++)
+		if (cpus[i].online && (mask & CPU_MASK(i)) &&
+		    (best < 0 || cpus[i].nr_ready < cpus[best].nr_ready))
+			best = i;
+	return best;
+}
+
+#ifndef TOS_HOST
+
 /* helper function used in resign()
  * no local variable or function parameters in resign()
  * since we are manipulating stack directly
@@ -199,10 +339,16 @@ void resign()
 	asm("pushl %edi");
 
     // manipulate esp
+    kernel_lock_enter();
 	asm ("movl %%esp,%0" : "=r" (active_proc->esp) : );
+#ifdef TRACE_INTR_OFF
+    intr_off_switch();
+#endif
     active_proc = dispatcher();
     check_active(); // helper function 
+    switch_address_space(active_proc);
     asm ("movl %0,%%esp" : : "r" (active_proc->esp));
+    finish_switch(); // drops the kernel lock unless resuming with IF clear
 
     // restore context
     asm("popl %edi");
@@ -217,6 +363,8 @@ void resign()
     asm("iret");
 }
 
+#endif
+
 
 
 /*
@@ -225,17 +373,23 @@ void resign()
  * Initializes the necessary data structures.
  *
  * Steps:
- * 1. init the ready queue with null pointers
- * 2. clear ready_lists_state
+ * 1. init the ready queues of all CPUs with null pointers
+ * 2. clear their ready_lists_state
  * 3. add the first process (active_proc always exists) 
  */
 
 void init_dispatcher()
 {
-	int i;
-	for(i = 0; i < MAX_READY_QUEUES; i++)
-		ready_queue[i] = NULL;
+	int i, j;
+	for(i = 0; i < MAX_CPUS; i++) {
+		for(j = 0; j < MAX_READY_QUEUES; j++)
+			cpus[i].run_queue[j] = NULL;
+		cpus[i].run_queue_state = 0;
+		cpus[i].edf_queue = NULL;
+		cpus[i].edf_load = 0;
+		cpus[i].nr_ready = 0;
+	}
 
-	ready_lists_state = 0;
+	this_cpu()->online = TRUE;
 	add_ready_queue(active_proc);
 }
@@ -0,0 +1,171 @@
+
+#include <kernel.h>
+
+/*
+ * Earliest deadline first scheduling
+ *
+ * set_edf(proc, period, budget) puts a process into the EDF class: it
+ * is entitled to budget ticks of CPU time in every period of period
+ * ticks, and the work of a period has to be done by its end, the
+ * deadline. The first period starts right away. When the process is
+ * done with a period it calls edf_next_period(), which blocks it until
+ * the next one begins.
+ *
+ * While an EDF process has budget left it is on the EDF queue of its
+ * CPU, which the dispatcher serves before all priority levels, the
+ * earliest deadline first. Once the budget is used up the process
+ * falls back to its priority until the next period refills it, so one
+ * that overruns cannot starve the others.
+ *
+ * Admission control: the EDF processes of a CPU, budget / period
+ * summed, may use at most EDF_MAX_LOAD of it. Below that bound EDF
+ * meets every deadline; set_edf() turns away a process that does not
+ * fit on any CPU it may run on, and pins it to the CPU it fits on.
+ *
+ * Time is the PIT tick. edf_tick() charges each tick to the EDF
+ * process running when it arrives, starts new periods and counts a
+ * deadline miss for a process whose period ends before it called
+ * edf_next_period(). A late process carries on in the new period with
+ * a fresh budget.
+ */
+
+/* leave part of each CPU to the servers the real-time processes use */
+#define EDF_MAX_LOAD		(EDF_SCALE * 9 / 10)
+
+
+/* rounded up, so that admission errs on the safe side */
+static unsigned edf_load_of(unsigned period, unsigned budget)
+{
+    return (budget * EDF_SCALE + period - 1) / period;
+}
+
+/*
+ * The CPU in proc's affinity mask with room for load more, preferring
+ * the one it is on, or -1
+ */
+static int find_edf_cpu(PROCESS proc, unsigned load)
+{
+    int i;
+
+    if ((proc->affinity & CPU_MASK(proc->cpu)) &&
+	cpus[proc->cpu].edf_load + load <= EDF_MAX_LOAD)
+	return proc->cpu;
+    for (i = 0; i < num_cpus; i++)
+	if (cpus[i].online && (proc->affinity & CPU_MASK(i)) &&
+	    cpus[i].edf_load + load <= EDF_MAX_LOAD)
+	    return i;
+    return -1;
+}
+
+
+/*
+ * Makes proc an EDF process with the given period and budget in timer
+ * ticks, or with period 0 an ordinary process again. Returns FALSE,
+ * leaving proc as it was, if the parameters are invalid or the process
+ * is not admitted. A process that leaves the EDF class stays pinned to
+ * its CPU.
+ */
+BOOL set_edf(PROCESS proc, unsigned period, unsigned budget)
+{
+    volatile int saved_if;
+    unsigned old_load = 0, load = 0;
+    int cpu = proc->cpu;
+
+    if (period != 0 && (budget == 0 || budget > period))
+	return FALSE;
+
+    DISABLE_INTR(saved_if);
+    if (proc->edf_period != 0) {
+	old_load = edf_load_of(proc->edf_period, proc->edf_budget);
+	cpus[proc->cpu].edf_load -= old_load;
+    }
+    if (period != 0) {
+	load = edf_load_of(period, budget);
+	if ((cpu = find_edf_cpu(proc, load)) < 0) {
+	    cpus[proc->cpu].edf_load += old_load;
+	    ENABLE_INTR(saved_if);
+	    return FALSE;
+	}
+    }
+
+    /* off the EDF queue while the parameters change */
+    set_edf_budget(proc, 0, proc->edf_deadline);
+    proc->edf_period = period;
+    proc->edf_budget = budget;
+    if (period != 0) {
+	cpus[cpu].edf_load += load;
+	set_affinity(proc, CPU_MASK(cpu));
+	proc->edf_misses = 0;
+	set_edf_budget(proc, budget, timer_ticks + period);
+    }
+    if (proc->state == STATE_PERIOD_BLOCKED)
+	add_ready_queue(proc);
+    ENABLE_INTR(saved_if);
+    return TRUE;
+}
+
+
+/*
+ * Called by an EDF process that is done with the current period.
+ * Blocks until the next period starts. Returns at once if the process
+ * has been taken out of the EDF class, possibly while it was blocked.
+ */
+void edf_next_period()
+{
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    if (active_proc->edf_period == 0) {
+	ENABLE_INTR(saved_if);
+	return;
+    }
+    active_proc->state = STATE_PERIOD_BLOCKED;
+    remove_ready_queue(active_proc);
+    resign();
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Called from the timer interrupt with the kernel lock held, after
+ * timer_ticks has advanced
+ */
+void edf_tick()
+{
+    PROCESS p;
+    int i;
+
+    for (i = 0, p = pcb; i < MAX_PROCS; i++, p++) {
+	if (!p->used || p->edf_period == 0)
+	    continue;
+	if (p->edf_left != 0 && p->state == STATE_READY &&
+	    p == cpus[p->cpu].current)
+	    set_edf_budget(p, p->edf_left - 1, p->edf_deadline);
+	if ((int) (timer_ticks - p->edf_deadline) < 0)
+	    continue;
+
+	/* the period is over */
+	if (p->state != STATE_PERIOD_BLOCKED)
+	    p->edf_misses++;
+	set_edf_budget(p, p->edf_budget, p->edf_deadline + p->edf_period);
+	if (p->state == STATE_PERIOD_BLOCKED)
+	    add_ready_queue(p);
+    }
+}
+
+
+void print_edf(WINDOW* wnd)
+{
+    PROCESS p;
+    int i;
+
+    wprintf(wnd, "Name                     CPU  Period  Budget  Left  Misses\n");
+    for (i = 0, p = pcb; i < MAX_PROCS; i++, p++)
+	if (p->used && p->edf_period != 0)
+	    wprintf(wnd, "%-25s%-5d%-8d%-8d%-6d%d\n", p->name, p->cpu,
+		    p->edf_period, p->edf_budget, p->edf_left, p->edf_misses);
+    for (i = 0; i < num_cpus; i++)
+	if (cpus[i].online)
+	    wprintf(wnd, "CPU %d: %d/%d admitted\n", i,
+		    cpus[i].edf_load, EDF_SCALE);
+}
@@ -0,0 +1,166 @@
+
+#include <kernel.h>
+
+/*
+ * Lazy FPU switching
+ *
+ * resign() and the interrupt stubs only save the integer registers.
+ * Saving the FPU and SSE registers as well would make every switch
+ * more expensive, although most processes never touch them. Instead,
+ * each CPU leaves the registers of the last process that used them,
+ * its fpu_owner, in place and sets CR0.TS when it switches to another
+ * process. The first FPU or SSE instruction of that process then
+ * raises exception 7 (device not available), and handle_fpu_trap()
+ * saves the owner's registers to its PCB, loads those of the process
+ * and makes it the owner. A process that gets the CPU back while it
+ * still owns the FPU runs with TS clear, so as long as only one
+ * process uses the FPU, nothing is ever saved.
+ *
+ * With more than one CPU the load balancer may move a process while
+ * its registers are still in another CPU's FPU. There, fpu_switch()
+ * saves the owner's registers when it switches it out after it has
+ * used them, and the state in the PCB is always current for a process
+ * that is not running. Loading stays lazy; fpu_cpu tells whether the
+ * registers of a CPU are still those of the process.
+ *
+ * A new process starts with the state fninit leaves.
+ */
+
+#define CR0_MP			0x00000002	/* wait honours TS */
+#define CR0_EM			0x00000004	/* no FPU, emulate it */
+#define CR0_TS			0x00000008	/* task switched */
+#define CR0_NE			0x00000020	/* FPU errors raise exception 16 */
+#define CR4_OSFXSR		0x00000200	/* fxsave, fxrstor and SSE */
+#define CR4_OSXMMEXCPT		0x00000400	/* SSE errors raise exception 19 */
+
+static BOOL fpu_present;
+static BOOL fpu_fxsr;			/* fxsave instead of fnsave */
+static FPU_STATE fpu_initial;		/* after fninit */
+
+
+static unsigned read_cr0()
+{
+    unsigned cr0;
+
+    asm volatile ("movl %%cr0,%0" : "=r" (cr0));
+    return cr0;
+}
+
+static void write_cr0(unsigned cr0)
+{
+    asm volatile ("movl %0,%%cr0" : : "r" (cr0));
+}
+
+/* lets FPU instructions raise exception 7 */
+static void set_ts()
+{
+    unsigned cr0 = read_cr0();
+
+    if (!(cr0 & CR0_TS))
+	write_cr0(cr0 | CR0_TS);
+}
+
+static void fpu_save(FPU_STATE* state)
+{
+    if (fpu_fxsr)
+	asm volatile ("fxsave %0" : "=m" (*state));
+    else
+	asm volatile ("fnsave %0; fwait" : "=m" (*state));
+}
+
+static void fpu_restore(FPU_STATE* state)
+{
+    if (fpu_fxsr)
+	asm volatile ("fxrstor %0" : : "m" (*state));
+    else
+	asm volatile ("frstor %0" : : "m" (*state));
+}
+
+
+/*
+ * Enables the FPU and, if the CPU has it, SSE on the calling CPU. The
+ * boot CPU calls this after init_interrupts(), the other CPUs when they
+ * start. Without an FPU, FPU instructions stay fatal.
+ */
+void init_fpu()
+{
+    CPU_DEF* cpu = this_cpu();
+    unsigned features = cpu_features();
+    unsigned cr4;
+
+    cpu->fpu_owner = NULL;
+    cpu->fpu_dirty = FALSE;
+    if (!(features & CPU_FEATURE_FPU))
+	return;
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if (features & CPU_FEATURE_FXSR) {
+	asm volatile ("movl %%cr4,%0" : "=r" (cr4));
+	cr4 |= CR4_OSFXSR;
+	if (features & CPU_FEATURE_SSE)
+	    cr4 |= CR4_OSXMMEXCPT;
+	asm volatile ("movl %0,%%cr4" : : "r" (cr4));
+    }
+    asm volatile ("fninit");
+    if (cpu->id == BOOT_CPU) {
+	fpu_fxsr = (features & CPU_FEATURE_FXSR) != 0;
+	fpu_save(&fpu_initial);
+	fpu_present = TRUE;
+    }
+    set_ts();
+}
+
+
+/*
+ * Called by finish_switch() with the kernel lock held, before next
+ * resumes on the calling CPU
+ */
+void fpu_switch(PROCESS next)
+{
+    CPU_DEF* cpu = this_cpu();
+    PROCESS owner = cpu->fpu_owner;
+
+    if (!fpu_present)
+	return;
+    if (owner == next && next->fpu_cpu == cpu->id) {
+	/* its registers are still loaded */
+	asm volatile ("clts");
+	cpu->fpu_dirty = TRUE;
+	return;
+    }
+    if (owner != NULL && cpu->fpu_dirty && num_cpus > 1) {
+	/* another CPU may run the owner next */
+	fpu_save(&owner->fpu);
+	cpu->fpu_dirty = FALSE;
+    }
+    set_ts();
+}
+
+
+/*
+ * Called by handle_exception() for exception 7, with interrupts off:
+ * the active process used the FPU while another one owns it. Returns
+ * FALSE if there is no FPU.
+ */
+BOOL handle_fpu_trap()
+{
+    CPU_DEF* cpu = this_cpu();
+    PROCESS owner = cpu->fpu_owner;
+
+    if (!fpu_present)
+	return FALSE;
+    asm volatile ("clts");
+    if (owner != active_proc || active_proc->fpu_cpu != cpu->id) {
+	if (owner != NULL && cpu->fpu_dirty)
+	    fpu_save(&owner->fpu);
+	if (active_proc->fpu_used)
+	    fpu_restore(&active_proc->fpu);
+	else
+	    fpu_restore(&fpu_initial);
+	active_proc->fpu_used = TRUE;
+	active_proc->fpu_cpu = cpu->id;
+	cpu->fpu_owner = active_proc;
+    }
+    cpu->fpu_dirty = TRUE;
+    return TRUE;
+}
@@ -0,0 +1,248 @@
+
+#include <kernel.h>
+
+/*
+ * Page-frame allocator
+ *
+ * All installed RAM the kernel can reach, i.e. below IDENTITY_MAP_END,
+ * is tracked in a bitmap with one bit per 4KB frame (1 = in use). The
+ * bitmap itself is placed at the start of the first available region
+ * above 1MB. Memory below 1MB is never handed out: it holds the kernel
+ * image, the kernel heap, the process stacks, video memory and the
+ * BIOS.
+ */
+
+#define LOW_MEMORY_END		(1024 * 1024)
+#define BITS_PER_WORD		32
+#define ALL_USED		0xFFFFFFFF
+
+
+static MEMORY_MAP  memory_map;
+static LONG*       frame_bitmap;
+static unsigned    bitmap_words;
+static unsigned    num_frames;
+static unsigned    free_frames;
+static unsigned    next_word;
+
+
+static void mark_frame_used(unsigned frame)
+{
+    frame_bitmap[frame / BITS_PER_WORD] |= 1 << (frame % BITS_PER_WORD);
+}
+
+static void mark_frame_free(unsigned frame)
+{
+    frame_bitmap[frame / BITS_PER_WORD] &= ~(1 << (frame % BITS_PER_WORD));
+}
+
+static BOOL is_frame_free(unsigned frame)
+{
+    return (frame_bitmap[frame / BITS_PER_WORD] &
+	    (1 << (frame % BITS_PER_WORD))) == 0;
+}
+
+
+/*
+ * Returns the part of a region that lies below IDENTITY_MAP_END as
+ * [*start, *end). Returns FALSE if nothing is left of it.
+ */
+static BOOL region_bounds(MEMORY_REGION* r, MEM_ADDR* start, MEM_ADDR* end)
+{
+    if (r->base_high != 0 || (r->length_low == 0 && r->length_high == 0) ||
+	r->base_low >= IDENTITY_MAP_END)
+	return FALSE;
+    *start = r->base_low;
+    if (r->length_high != 0 || r->base_low + r->length_low < r->base_low ||
+	r->base_low + r->length_low > IDENTITY_MAP_END)
+	*end = IDENTITY_MAP_END;
+    else
+	*end = r->base_low + r->length_low;
+    return TRUE;
+}
+
+
+/*
+ * Without a map from the boot loader, the size of extended memory
+ * (up to 64MB) is read from the CMOS.
+ */
+static void probe_memory_map()
+{
+    unsigned ext_kb;
+
+    outportb(0x70, 0x17);
+    ext_kb = inportb(0x71);
+    outportb(0x70, 0x18);
+    ext_kb |= inportb(0x71) << 8;
+
+    memory_map.magic = MEMORY_MAP_MAGIC;
+    memory_map.num_regions = 2;
+    memory_map.region[0].base_low = 0;
+    memory_map.region[0].length_low = 640 * 1024;
+    memory_map.region[0].type = MEMORY_AVAILABLE;
+    memory_map.region[1].base_low = LOW_MEMORY_END;
+    memory_map.region[1].length_low = ext_kb * 1024;
+    memory_map.region[1].type = MEMORY_AVAILABLE;
+}
+
+
+void init_page_frames(MEMORY_MAP* map)
+{
+    MEMORY_REGION* r;
+    MEM_ADDR start, end, top, bitmap_size;
+    unsigned i, frame;
+
+    if ((MEM_ADDR) map < LOW_MEMORY_END && map->magic == MEMORY_MAP_MAGIC &&
+	map->num_regions > 0 && map->num_regions <= MAX_MEMORY_REGIONS)
+	k_memcpy(&memory_map, map, sizeof(memory_map));
+    else
+	probe_memory_map();
+
+    /* size the bitmap for the highest available address */
+    top = LOW_MEMORY_END;
+    for (i = 0; i < memory_map.num_regions; i++) {
+	r = &memory_map.region[i];
+	if (r->type == MEMORY_AVAILABLE && region_bounds(r, &start, &end) &&
+	    end > top)
+	    top = end;
+    }
+    num_frames = top >> PAGE_SHIFT;
+    bitmap_words = (num_frames + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    bitmap_size = (bitmap_words * sizeof(LONG) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    /* the bitmap goes into the first region above 1MB it fits in */
+    frame_bitmap = NULL;
+    for (i = 0; i < memory_map.num_regions && frame_bitmap == NULL; i++) {
+	r = &memory_map.region[i];
+	if (r->type != MEMORY_AVAILABLE || !region_bounds(r, &start, &end))
+	    continue;
+	if (start < LOW_MEMORY_END)
+	    start = LOW_MEMORY_END;
+	start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (end > start && end - start >= bitmap_size)
+	    frame_bitmap = (LONG*) start;
+    }
+    if (frame_bitmap == NULL) {
+	/* no extended memory at all */
+	num_frames = 0;
+	free_frames = 0;
+	return;
+    }
+
+    k_memset(frame_bitmap, 0xFF, bitmap_words * sizeof(LONG));
+    free_frames = 0;
+    for (i = 0; i < memory_map.num_regions; i++) {
+	r = &memory_map.region[i];
+	if (r->type != MEMORY_AVAILABLE || !region_bounds(r, &start, &end))
+	    continue;
+	if (start < LOW_MEMORY_END)
+	    start = LOW_MEMORY_END;
+	for (frame = (start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	     frame < (end >> PAGE_SHIFT); frame++) {
+	    if (!is_frame_free(frame))
+		free_frames++;
+	    mark_frame_free(frame);
+	}
+    }
+
+    /* regions may overlap with reserved ones; reserved wins */
+    for (i = 0; i < memory_map.num_regions; i++) {
+	r = &memory_map.region[i];
+	if (r->type == MEMORY_AVAILABLE || !region_bounds(r, &start, &end))
+	    continue;
+	for (frame = start >> PAGE_SHIFT;
+	     frame < num_frames && frame < (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	     frame++) {
+	    if (is_frame_free(frame))
+		free_frames--;
+	    mark_frame_used(frame);
+	}
+    }
+
+    for (frame = (MEM_ADDR) frame_bitmap >> PAGE_SHIFT;
+	 frame < ((MEM_ADDR) frame_bitmap + bitmap_size) >> PAGE_SHIFT;
+	 frame++) {
+	if (is_frame_free(frame))
+	    free_frames--;
+	mark_frame_used(frame);
+    }
+    next_word = 0;
+}
+
+
+/*
+ * Allocates one 4KB page frame and returns its physical address,
+ * or 0 if physical memory is exhausted.
+ */
+MEM_ADDR alloc_page_frame()
+{
+    unsigned i, w, bit;
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    for (i = 0; i < bitmap_words; i++) {
+	w = next_word + i;
+	if (w >= bitmap_words)
+	    w -= bitmap_words;
+	if (frame_bitmap[w] == ALL_USED)
+	    continue;
+	for (bit = 0; frame_bitmap[w] & (1 << bit); bit++)
+	    ;
+	if (w * BITS_PER_WORD + bit >= num_frames)
+	    continue;
+	frame_bitmap[w] |= 1 << bit;
+	free_frames--;
+	next_word = w;
+	ENABLE_INTR(saved_if);
+	return (w * BITS_PER_WORD + bit) << PAGE_SHIFT;
+    }
+    ENABLE_INTR(saved_if);
+    return 0;
+}
+
+
+void free_page_frame(MEM_ADDR addr)
+{
+    unsigned frame = addr >> PAGE_SHIFT;
+    volatile int saved_if;
+
+    assert((addr & (PAGE_SIZE - 1)) == 0);
+    assert(addr >= LOW_MEMORY_END && frame < num_frames);
+    DISABLE_INTR(saved_if);
+    assert(!is_frame_free(frame));
+    mark_frame_free(frame);
+    free_frames++;
+    if (frame / BITS_PER_WORD < next_word)
+	next_word = frame / BITS_PER_WORD;
+    ENABLE_INTR(saved_if);
+}
+
+
+unsigned num_free_page_frames()
+{
+    return free_frames;
+}
+
+
+/*
+ * Highest physical address covered by the frame allocator
+ */
+MEM_ADDR get_memory_top()
+{
+    return num_frames << PAGE_SHIFT;
+}
+
+
+void print_memory_map(WINDOW* wnd)
+{
+    MEMORY_REGION* r;
+    unsigned i;
+
+    wprintf(wnd, "Base              Length            Type\n");
+    for (i = 0; i < memory_map.num_regions; i++) {
+	r = &memory_map.region[i];
+	wprintf(wnd, "%08x%08x  %08x%08x  %d\n",
+		r->base_high, r->base_low, r->length_high, r->length_low,
+		r->type);
+    }
+    wprintf(wnd, "%d of %d page frames free\n", free_frames, num_frames);
+}
@@ -0,0 +1,173 @@
+
+#include <kernel.h>
+
+/*
+ * Memory grants
+ *
+ * A sender lends a buffer to the receiver of a send() for as long as
+ * the sender is reply blocked. The grant descriptor lives in the
+ * sender's memory (usually on its stack) and is passed as the message
+ * data. The receiver calls map_grant() to get a pointer to the buffer
+ * and reply_grant() to give it back:
+ *
+ *	sender:			receiver:
+ *	GRANT g;		g = (GRANT*) receive(&sender);
+ *	init_grant(&g, ...);	buf = map_grant(sender, g);
+ *	send_grant(port, &g);	... use buf ...
+ *				reply_grant(sender, g);
+ *
+ * No data is copied. If both processes see the buffer at the same
+ * address (it lies in kernel memory, or they share an address space)
+ * map_grant() returns the buffer itself. Otherwise the owner's frames
+ * are mapped into a slot of the receiver's grant window and unmapped
+ * again before the reply.
+ */
+
+
+static BOOL same_view(PROCESS owner, PROCESS receiver, void* buffer)
+{
+    return (MEM_ADDR) buffer < USER_SPACE_BASE ||
+	   owner->page_dir == 0 || owner->page_dir == receiver->page_dir;
+}
+
+static int alloc_grant_slot(PROCESS proc)
+{
+    int slot;
+
+    for (slot = 0; slot < MAX_GRANT_SLOTS; slot++) {
+	if (!(proc->grant_slots & (1 << slot))) {
+	    proc->grant_slots |= 1 << slot;
+	    return slot;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * Describes the buffer [buffer, buffer+length) of the calling process
+ * as a grant with the given access rights.
+ */
+void init_grant(GRANT* grant, void* buffer, int length, unsigned access)
+{
+    assert(length >= 0 && length <= GRANT_SLOT_SIZE - PAGE_SIZE);
+    grant->magic = MAGIC_GRANT;
+    grant->owner = active_proc;
+    grant->buffer = buffer;
+    grant->length = length;
+    grant->access = access;
+    grant->mapped_by = NULL;
+    grant->mapped_addr = NULL;
+    grant->slot = -1;
+}
+
+
+/*
+ * Sends the grant to dest_port. Like send(), returns after the
+ * receiver has replied, at which point the buffer is no longer
+ * accessible to the receiver.
+ */
+void send_grant(PORT dest_port, GRANT* grant)
+{
+    assert(grant->magic == MAGIC_GRANT && grant->owner == active_proc);
+    send(dest_port, grant);
+    assert(grant->mapped_by == NULL);
+}
+
+
+/*
+ * Makes a grant received from sender accessible to the calling process
+ * and returns the address of the buffer. Returns NULL if the grant
+ * window is full or page tables cannot be allocated.
+ */
+void* map_grant(PROCESS sender, GRANT* grant)
+{
+    PROCESS receiver = active_proc;
+    MEM_ADDR first, last, page, phys, window;
+    unsigned flags;
+    volatile int saved_if;
+
+    assert(grant->magic == MAGIC_GRANT);
+    assert(grant->owner == sender && sender->state == STATE_REPLY_BLOCKED);
+    assert(grant->mapped_by == NULL);
+
+    if (same_view(sender, receiver, grant->buffer)) {
+	grant->mapped_by = receiver;
+	grant->mapped_addr = grant->buffer;
+	return grant->buffer;
+    }
+
+    DISABLE_INTR(saved_if);
+    if (receiver->page_dir == 0) {
+	/* a kernel-only receiver needs its own window for the mapping */
+	if ((receiver->page_dir = create_address_space()) == 0) {
+	    ENABLE_INTR(saved_if);
+	    return NULL;
+	}
+	switch_address_space(receiver);
+    }
+    if ((grant->slot = alloc_grant_slot(receiver)) < 0) {
+	ENABLE_INTR(saved_if);
+	return NULL;
+    }
+
+    flags = PAGE_USER;
+    if (grant->access & GRANT_WRITE)
+	flags |= PAGE_WRITABLE;
+    window = GRANT_WINDOW_BASE + grant->slot * GRANT_SLOT_SIZE;
+    first = (MEM_ADDR) grant->buffer & ~(PAGE_SIZE - 1);
+    last = (MEM_ADDR) grant->buffer + grant->length;
+    for (page = first; page < last; page += PAGE_SIZE) {
+	phys = lookup_page(sender->page_dir, page);
+	assert(phys != 0);
+	if (!map_page(receiver->page_dir, window + (page - first), phys, flags)) {
+	    grant->mapped_by = receiver;
+	    unmap_grant(grant);
+	    ENABLE_INTR(saved_if);
+	    return NULL;
+	}
+    }
+    grant->mapped_by = receiver;
+    grant->mapped_addr = (void*) (window + ((MEM_ADDR) grant->buffer & (PAGE_SIZE - 1)));
+    ENABLE_INTR(saved_if);
+    return grant->mapped_addr;
+}
+
+
+/*
+ * Revokes the receiver's access to a grant.
+ */
+void unmap_grant(GRANT* grant)
+{
+    PROCESS receiver = grant->mapped_by;
+    MEM_ADDR window, offset;
+    volatile int saved_if;
+
+    assert(grant->magic == MAGIC_GRANT);
+    if (receiver == NULL)
+	return;
+
+    DISABLE_INTR(saved_if);
+    if (grant->slot >= 0) {
+	window = GRANT_WINDOW_BASE + grant->slot * GRANT_SLOT_SIZE;
+	for (offset = 0; offset < GRANT_SLOT_SIZE; offset += PAGE_SIZE)
+	    if (unmap_page(receiver->page_dir, window + offset) == 0)
+		break;
+	receiver->grant_slots &= ~(1 << grant->slot);
+	grant->slot = -1;
+    }
+    grant->mapped_by = NULL;
+    grant->mapped_addr = NULL;
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Unmaps the grant and replies to its owner.
+ */
+void reply_grant(PROCESS sender, GRANT* grant)
+{
+    assert(grant->owner == sender);
+    unmap_grant(grant);
+    reply(sender);
+}
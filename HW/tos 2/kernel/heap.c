@@ -0,0 +1,362 @@
+
+#include <kernel.h>
+
+/*
+ * Kernel heap
+ *
+ * Large blocks are managed by a binary buddy allocator with one free
+ * list per order, from a single page (4KB) up to HEAP_MAX_ORDER.
+ * Requests of at most SMALL_MAX_SIZE bytes are served from segregated
+ * size classes (16, 32, ... 2048 bytes). Each class keeps a free list
+ * of objects carved out of pages taken from the buddy allocator, so
+ * that allocating and freeing a small object is a list push/pop.
+ *
+ * page_info[] holds one byte per heap page describing it:
+ *   PAGE_FREE | order	first page of a free buddy block
+ *   PAGE_HEAD | order	first page of an allocated buddy block
+ *   PAGE_SLAB | class	page carved into objects of a size class
+ *   0			any other page of a buddy block
+ */
+
+#define HEAP_NUM_ORDERS		(HEAP_MAX_ORDER - HEAP_MIN_ORDER + 1)
+#define HEAP_MAX_PAGES		(1 << (HEAP_MAX_ORDER - PAGE_SHIFT))
+
+#define SMALL_MIN_SHIFT		4
+#define SMALL_MAX_SIZE		(1 << (SMALL_MIN_SHIFT + NUM_SIZE_CLASSES - 1))
+
+#define PAGE_FREE		0x80
+#define PAGE_HEAD		0x40
+#define PAGE_SLAB		0x20
+#define PAGE_ORDER_MASK		0x1f
+
+
+typedef struct _FREE_BLOCK {
+    struct _FREE_BLOCK* next;
+    struct _FREE_BLOCK* prev;
+} FREE_BLOCK;
+
+typedef struct _FREE_OBJECT {
+    struct _FREE_OBJECT* next;
+} FREE_OBJECT;
+
+
+static char*        heap_base;
+static unsigned     heap_pages;
+static BYTE         page_info[HEAP_MAX_PAGES];
+static FREE_BLOCK*  free_blocks[HEAP_NUM_ORDERS];
+static FREE_OBJECT* free_objects[NUM_SIZE_CLASSES];
+static HEAP_STATS   stats;
+
+
+/* page number of the heap page containing ptr */
+static unsigned page_of(void* ptr)
+{
+    return ((char*) ptr - heap_base) >> PAGE_SHIFT;
+}
+
+static void* page_addr(unsigned page)
+{
+    return heap_base + (page << PAGE_SHIFT);
+}
+
+/* smallest order whose blocks hold size bytes */
+static int order_for_size(unsigned size)
+{
+    int order = HEAP_MIN_ORDER;
+    while ((1u << order) < size)
+	order++;
+    return order;
+}
+
+/* smallest size class whose objects hold size bytes */
+static int class_for_size(unsigned size)
+{
+    int class = 0;
+    while ((1u << (class + SMALL_MIN_SHIFT)) < size)
+	class++;
+    return class;
+}
+
+
+/*
+ * Buddy allocator
+ */
+
+static void push_block(unsigned page, int order)
+{
+    FREE_BLOCK* block = (FREE_BLOCK*) page_addr(page);
+    FREE_BLOCK** head = &free_blocks[order - HEAP_MIN_ORDER];
+
+    block->prev = NULL;
+    block->next = *head;
+    if (*head != NULL)
+	(*head)->prev = block;
+    *head = block;
+    page_info[page] = PAGE_FREE | order;
+    stats.free_bytes += 1 << order;
+    stats.free_blocks[order - HEAP_MIN_ORDER]++;
+}
+
+static void unlink_block(unsigned page, int order)
+{
+    FREE_BLOCK* block = (FREE_BLOCK*) page_addr(page);
+
+    if (block->prev != NULL)
+	block->prev->next = block->next;
+    else
+	free_blocks[order - HEAP_MIN_ORDER] = block->next;
+    if (block->next != NULL)
+	block->next->prev = block->prev;
+    page_info[page] = 0;
+    stats.free_bytes -= 1 << order;
+    stats.free_blocks[order - HEAP_MIN_ORDER]--;
+}
+
+/* returns the first page of a block of the given order, or -1 */
+static int alloc_block(int order)
+{
+    int o;
+    unsigned page;
+
+    for (o = order; o <= HEAP_MAX_ORDER; o++)
+	if (free_blocks[o - HEAP_MIN_ORDER] != NULL)
+	    break;
+    if (o > HEAP_MAX_ORDER)
+	return -1;
+
+    page = page_of(free_blocks[o - HEAP_MIN_ORDER]);
+    unlink_block(page, o);
+
+    /* split, returning the upper halves to the free lists */
+    while (o > order) {
+	o--;
+	push_block(page + (1 << (o - PAGE_SHIFT)), o);
+    }
+    page_info[page] = PAGE_HEAD | order;
+    return page;
+}
+
+static void free_block(unsigned page, int order)
+{
+    unsigned buddy;
+
+    /* coalesce with the buddy for as long as it is free as a whole */
+    while (order < HEAP_MAX_ORDER) {
+	buddy = page ^ (1 << (order - PAGE_SHIFT));
+	if (buddy + (1 << (order - PAGE_SHIFT)) > heap_pages ||
+	    page_info[buddy] != (PAGE_FREE | order))
+	    break;
+	unlink_block(buddy, order);
+	if (buddy < page)
+	    page = buddy;
+	order++;
+    }
+    push_block(page, order);
+}
+
+
+/*
+ * Size classes
+ */
+
+/* carve a fresh page into objects of the given size class */
+static BOOL refill_class(int class)
+{
+    unsigned size = 1 << (class + SMALL_MIN_SHIFT);
+    FREE_OBJECT* obj;
+    char* p;
+    int page;
+
+    page = alloc_block(HEAP_MIN_ORDER);
+    if (page < 0)
+	return FALSE;
+    page_info[page] = PAGE_SLAB | class;
+    stats.small_pages++;
+
+    for (p = page_addr(page); p + size <= (char*) page_addr(page + 1); p += size) {
+	obj = (FREE_OBJECT*) p;
+	obj->next = free_objects[class];
+	free_objects[class] = obj;
+	stats.small_cached += size;
+    }
+    return TRUE;
+}
+
+
+/*
+ * Allocates size bytes from the kernel heap. Returns NULL if
+ * the request cannot be satisfied.
+ */
+void* k_malloc(int size)
+{
+    FREE_OBJECT* obj;
+    void* ptr = NULL;
+    int class, order, page;
+    volatile int saved_if;
+
+    if (size <= 0)
+	return NULL;
+
+    DISABLE_INTR(saved_if);
+    if (size <= SMALL_MAX_SIZE) {
+	class = class_for_size(size);
+	if (free_objects[class] != NULL || refill_class(class)) {
+	    obj = free_objects[class];
+	    free_objects[class] = obj->next;
+	    stats.small_cached -= 1 << (class + SMALL_MIN_SHIFT);
+	    stats.small_allocated += 1 << (class + SMALL_MIN_SHIFT);
+	    ptr = obj;
+	}
+    } else {
+	order = order_for_size(size);
+	if (order <= HEAP_MAX_ORDER && (page = alloc_block(order)) >= 0) {
+	    stats.large_allocated += 1 << order;
+	    ptr = page_addr(page);
+	}
+    }
+    if (ptr != NULL)
+	stats.num_malloc++;
+    else
+	stats.num_failed++;
+    ENABLE_INTR(saved_if);
+    return ptr;
+}
+
+
+/*
+ * Returns memory obtained from k_malloc() to the heap.
+ * k_free(NULL) does nothing.
+ */
+void k_free(void* ptr)
+{
+    FREE_OBJECT* obj;
+    unsigned page;
+    BYTE info;
+    int class, order;
+    volatile int saved_if;
+
+    if (ptr == NULL)
+	return;
+
+    DISABLE_INTR(saved_if);
+    assert((char*) ptr >= heap_base &&
+	   (char*) ptr < heap_base + (heap_pages << PAGE_SHIFT));
+    page = page_of(ptr);
+    info = page_info[page];
+    if (info & PAGE_SLAB) {
+	class = info & PAGE_ORDER_MASK;
+	obj = (FREE_OBJECT*) ptr;
+	obj->next = free_objects[class];
+	free_objects[class] = obj;
+	stats.small_cached += 1 << (class + SMALL_MIN_SHIFT);
+	stats.small_allocated -= 1 << (class + SMALL_MIN_SHIFT);
+    } else {
+	assert(info & PAGE_HEAD);
+	assert(page_addr(page) == ptr);
+	order = info & PAGE_ORDER_MASK;
+	stats.large_allocated -= 1 << order;
+	free_block(page, order);
+    }
+    stats.num_free++;
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Fills in the current heap statistics
+ */
+void get_heap_stats(HEAP_STATS* s)
+{
+    int o;
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    *s = stats;
+    s->largest_free = 0;
+    for (o = HEAP_MAX_ORDER; o >= HEAP_MIN_ORDER; o--) {
+	if (free_blocks[o - HEAP_MIN_ORDER] != NULL) {
+	    s->largest_free = 1 << o;
+	    break;
+	}
+    }
+    ENABLE_INTR(saved_if);
+}
+
+
+void print_heap_stats(WINDOW* wnd)
+{
+    HEAP_STATS s;
+    int o, fragmentation;
+
+    get_heap_stats(&s);
+    /* share of the free memory that is not part of the largest block */
+    fragmentation = 0;
+    if (s.free_bytes != 0)
+	fragmentation = 100 - (s.largest_free / 1024 * 100) / (s.free_bytes / 1024);
+
+    wprintf(wnd, "Heap: %d KB, %d KB free, largest free block %d KB\n",
+	    s.heap_size / 1024, s.free_bytes / 1024, s.largest_free / 1024);
+    wprintf(wnd, "Small: %d pages, %d bytes used, %d bytes cached\n",
+	    s.small_pages, s.small_allocated, s.small_cached);
+    wprintf(wnd, "Large: %d bytes used\n", s.large_allocated);
+    wprintf(wnd, "Calls: %d malloc, %d free, %d failed\n",
+	    s.num_malloc, s.num_free, s.num_failed);
+    wprintf(wnd, "Fragmentation: %d%%\nFree blocks:", fragmentation);
+    for (o = HEAP_MIN_ORDER; o <= HEAP_MAX_ORDER; o++)
+	if (s.free_blocks[o - HEAP_MIN_ORDER] != 0)
+	    wprintf(wnd, " %dK:%d", (1 << o) / 1024,
+		    s.free_blocks[o - HEAP_MIN_ORDER]);
+    wprintf(wnd, "\n");
+}
+
+
+/*
+ * Places the heap in the memory region [start, start+size). The region
+ * is trimmed to whole pages.
+ */
+void init_heap_region(void* start, unsigned size)
+{
+    unsigned long first, last;
+    unsigned page;
+    int i, order;
+
+    first = ((unsigned long) start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    last = ((unsigned long) start + size) & ~(PAGE_SIZE - 1);
+    assert(last > first);
+
+    heap_base = (char*) first;
+    heap_pages = (last - first) >> PAGE_SHIFT;
+    if (heap_pages > HEAP_MAX_PAGES)
+	heap_pages = HEAP_MAX_PAGES;
+
+    for (i = 0; i < HEAP_NUM_ORDERS; i++)
+	free_blocks[i] = NULL;
+    for (i = 0; i < NUM_SIZE_CLASSES; i++)
+	free_objects[i] = NULL;
+    k_memset(&stats, 0, sizeof(stats));
+    stats.heap_size = heap_pages << PAGE_SHIFT;
+
+    /* cover the region with the largest naturally aligned blocks */
+    page = 0;
+    while (page < heap_pages) {
+	order = HEAP_MAX_ORDER;
+	while ((page & ((1 << (order - PAGE_SHIFT)) - 1)) != 0 ||
+	       page + (1 << (order - PAGE_SHIFT)) > heap_pages)
+	    order--;
+	push_block(page, order);
+	page += 1 << (order - PAGE_SHIFT);
+    }
+}
+
+
+/*
+ * The kernel heap takes the memory between the end of the kernel
+ * image and the lowest process stack.
+ */
+void init_heap()
+{
+    extern char _end[];
+    MEM_ADDR stack_bottom = STACK_TOP - MAX_PROCS * STACK_SIZE;
+
+    init_heap_region(_end, stack_bottom - (unsigned long) _end);
+}
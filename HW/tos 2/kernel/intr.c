@@ -5,7 +5,6 @@ BOOL interrupts_initialized = FALSE;
 
 IDT idt [MAX_INTERRUPTS];
 PROCESS interrupt_table [MAX_INTERRUPTS];
-PROCESS p;
 
 
 void load_idt (IDT* base)
@@ -38,242 +37,411 @@ void init_idt_entry (int intr_no, void (*isr) (void))
     idt[intr_no].p            = 1;
 }
 
-void catastrophic_isr(int n)
+/*
+ * Entry stubs
+ *
+ * Every CPU exception and every PIC line has a small trampoline that
+ * records its vector number and jumps to a common stub. The trampolines
+ * are generated with assembler loops, each padded to STUB_SIZE bytes,
+ * so the entry for vector n is found by address arithmetic. Exceptions
+ * that do not push an error code get a dummy one, so that every
+ * exception frame has the same layout.
+ *
+ * exc_common saves the registers, calls handle_exception() and returns
+ * to the interrupted code. irq_common saves the context of the active
+ * process the same way resign() does, lets irq_dispatch() handle the
+ * interrupt and pick the next process, and resumes that process.
+ * irq_dispatch() runs with the kernel lock held; finish_switch() drops
+ * it on the stack of the resumed process.
+ *
+ * The local APIC timer enters through irq_common as well. Spurious
+ * interrupts of the local APIC must not be acknowledged, so their stub
+ * returns at once.
+ */
+
+#define STUB_SIZE	16
+
+void exc_stubs();
+void irq_stubs();
+void lapic_timer_stub();
+void spurious_stub();
+
+asm (".pushsection .text\n"
+     ".align 16\n"
+     "exc_stubs:\n"
+     ".set vec, 0\n"
+     ".rept 32\n"
+     "  .align 16\n"
+     "  .if !(vec == 8 || (vec >= 10 && vec <= 14) || vec == 17 || "
+	     "vec == 21 || vec == 29 || vec == 30)\n"
+     "  pushl $0\n"
+     "  .endif\n"
+     "  pushl $vec\n"
+     "  jmp exc_common\n"
+     "  .set vec, vec + 1\n"
+     ".endr\n"
+
+     "exc_common:\n"
+     "  pushl %eax; pushl %ecx; pushl %edx\n"
+     "  pushl %ebx; pushl %ebp; pushl %esi; pushl %edi\n"
+     "  pushl %esp\n"
+     "  call handle_exception\n"
+     "  addl $4,%esp\n"
+     "  popl %edi; popl %esi; popl %ebp; popl %ebx\n"
+     "  popl %edx; popl %ecx; popl %eax\n"
+     "  addl $8,%esp\n"
+     "  iret\n"
+
+     ".align 16\n"
+     "irq_stubs:\n"
+     ".set vec, 0x60\n"
+     ".rept 16\n"
+     "  .align 16\n"
+     "  pushl %eax\n"
+     "  movl $vec,%eax\n"
+     "  jmp irq_common\n"
+     "  .set vec, vec + 1\n"
+     ".endr\n"
+
+     "lapic_timer_stub:\n"
+     "  pushl %eax\n"
+     "  movl $0x70,%eax\n"	/* LAPIC_TIMER_VECTOR */
+     "  jmp irq_common\n"
+
+     "spurious_stub:\n"
+     "  iret\n"
+
+     "irq_common:\n"
+     "  pushl %ecx; pushl %edx\n"
+     "  pushl %ebx; pushl %ebp; pushl %esi; pushl %edi\n"
+     "  pushl %esp\n"
+     "  pushl %eax\n"
+     "  call irq_dispatch\n"
+     "  movl %eax,%esp\n"
+     "  call finish_switch\n"
+     "  popl %edi; popl %esi; popl %ebp; popl %ebx\n"
+     "  popl %edx; popl %ecx; popl %eax\n"
+     "  iret\n"
+     ".popsection\n");
+
+
+static const char* exception_name[] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow",
+    "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack fault", "General protection",
+    "Page fault", "Reserved", "x87 FPU error", "Alignment check",
+    "Machine check", "SIMD exception"
+};
+
+void catastrophic_isr(EXCEPTION_FRAME* frame)
 {
-    WINDOW w = {0, 24, 80, 1, 0, 0, ' '};
-    wprintf(&w, "Catastropic Interrupt#%d: %s\n", n, active_proc->name);
+    const char* name = "Reserved";
+
+    if (frame->vector < sizeof(exception_name) / sizeof(exception_name[0]))
+	name = exception_name[frame->vector];
+    wprintf(open_error_window(), "Exception %d (%s) at %08x, error %x: %s\n",
+	    frame->vector, name, frame->eip, frame->error_code,
+	    active_proc->name);
     while (1);
 }
 
-void exception0()
+void handle_exception(EXCEPTION_FRAME* frame)
 {
-    catastrophic_isr(0);
+    MEM_ADDR cr2;
+
+    if (frame->vector == 7 && handle_fpu_trap())
+	return;
+    if (frame->vector == 14) {
+	asm ("movl %%cr2,%0" : "=r" (cr2));
+	wprintf(open_error_window(), "Page fault at %08x (eip %08x): %s\n",
+		cr2, frame->eip, active_proc->name);
+	while (1);
+    }
+    catastrophic_isr(frame);
 }
 
-void exception1()
-{
-    catastrophic_isr(1);
-}
 
-void exception2()
+void isr_dummy();
+void dummy_isr() 
 {
-    catastrophic_isr(2);
-}
+    asm ("isr_dummy:");
+    asm ("push %eax; push %ecx; push %edx");
+    asm ("push %ebx; push %ebp; push %esi; push %edi");
 
-void exception3()
-{
-    catastrophic_isr(3);
-}
+    /*  do nothing */
 
-void exception4()
-{
-    catastrophic_isr(4);
+    asm ("movb  $0x20,%al");
+    asm ("outb  %al,$0x20");
+    asm ("pop %edi; pop %esi; pop %ebp; pop %ebx");
+    asm ("pop %edx; pop %ecx; pop %eax");
+    asm ("iret");
 }
 
-void exception5()
-{
-    catastrophic_isr(5);
-}
 
-void exception6()
-{
-    catastrophic_isr(6);
-}
+/*
+ * Device-specific work that has to be done in the ISR itself,
+ * indexed by IRQ line
+ */
+static void (*irq_handler[NUM_IRQS]) (int intr_no);
 
-void exception7()
+/*
+ * Deferred work scheduled on every interrupt of a line (see tasklet.c)
+ */
+static TASKLET* irq_tasklet[NUM_IRQS];
+
+void set_irq_handler(int intr_no, void (*handler) (int intr_no))
 {
-    catastrophic_isr(7);
+    assert(IS_IRQ(intr_no));
+    irq_handler[intr_no - IRQ_BASE] = handler;
 }
 
-void exception8()
+void set_irq_tasklet(int intr_no, TASKLET* t)
 {
-    catastrophic_isr(8);
+    assert(IS_IRQ(intr_no));
+    irq_tasklet[intr_no - IRQ_BASE] = t;
 }
 
-void exception9()
+/*
+ * Per-line counters. pending counts the interrupts that the next
+ * wait_for_interrupt() will return; interrupts that arrive while
+ * nobody serves them are coalesced there rather than lost. A line
+ * with a handler or tasklet is always served, so waiting for it only
+ * ever returns the interrupts that came during the wait.
+ */
+IRQ_STATS irq_stats[NUM_IRQS];
+
+static void count_irq(IRQ_STATS* s, BOOL served)
 {
-    catastrophic_isr(9);
+    s->count++;
+    if (!served) {
+	s->pending++;
+	s->missed++;
+    }
+    if (timer_ticks - s->window_start >= TIMER_HZ) {
+	s->rate = s->window_count;
+	s->window_count = 0;
+	s->window_start = timer_ticks;
+    }
+    s->window_count++;
 }
 
-void exception10()
+/*
+ * Processes waiting for an interrupt are queued on interrupt_table[]
+ * through their next_blocked links. irq_wake_all has a bit set for
+ * each line whose interrupts wake up every waiter rather than the
+ * first one only.
+ */
+static unsigned irq_wake_all;
+
+void set_irq_wake_mode(int intr_no, int mode)
 {
-    catastrophic_isr(10);
+    assert(IS_IRQ(intr_no));
+    if (mode == IRQ_WAKE_ALL)
+	irq_wake_all |= 1 << (intr_no - IRQ_BASE);
+    else
+	irq_wake_all &= ~(1 << (intr_no - IRQ_BASE));
 }
 
-void exception11()
+static int count_waiters(int intr_no)
 {
-    catastrophic_isr(11);
+    PROCESS p;
+    int n = 0;
+
+    for (p = interrupt_table[intr_no]; p != NULL; p = p->next_blocked)
+	n++;
+    return n;
 }
 
-void exception12()
+/* wake up the first waiter, or all of them, each with one interrupt */
+static void wake_waiters(int intr_no)
 {
-    catastrophic_isr(12);
+    PROCESS p;
+
+    do {
+	p = interrupt_table[intr_no];
+	interrupt_table[intr_no] = p->next_blocked;
+	p->next_blocked = NULL;
+	p->param_data = (void*) 1;
+	add_ready_queue(p);
+    } while (interrupt_table[intr_no] != NULL &&
+	     (irq_wake_all & (1 << (intr_no - IRQ_BASE))));
 }
 
-void exception13()
+/*
+ * Takes proc off the wait list it is on, if any. Used when a timed
+ * wait runs out.
+ */
+void remove_intr_waiter(PROCESS proc)
 {
-    catastrophic_isr(13);
+    PROCESS* p;
+    int i;
+
+    for (i = IRQ_BASE; i < IRQ_BASE + NUM_IRQS; i++) {
+	for (p = &interrupt_table[i]; *p != NULL; p = &(*p)->next_blocked) {
+	    if (*p == proc) {
+		*p = proc->next_blocked;
+		proc->next_blocked = NULL;
+		return;
+	    }
+	}
+    }
 }
 
-void exception14()
+
+void print_irq_stats(WINDOW* wnd)
 {
-    catastrophic_isr(14);
+    IRQ_STATS* s;
+    unsigned rate;
+    int i;
+
+    wprintf(wnd, "IRQ  Vector  Count       Missed      Pending  Waiters  Rate/s\n");
+    for (i = 0; i < NUM_IRQS; i++) {
+	s = &irq_stats[i];
+	if (s->count == 0)
+	    continue;
+	/* a line that has gone quiet has not closed its window */
+	rate = (timer_ticks - s->window_start >= 2 * TIMER_HZ) ? 0 : s->rate;
+	wprintf(wnd, "%-3d  %02x      %-10d  %-10d  %-7d  %-7d  %d\n",
+		i, IRQ(i), s->count, s->missed, s->pending,
+		count_waiters(IRQ(i)), rate);
+    }
 }
 
-void exception15()
+
+static void timer_irq(int intr_no)
 {
-    catastrophic_isr(15);
+    /* count the tick and wake up processes whose timeout has passed */
+    timer_tick();
+    edf_tick();
+    balance_cpus();
 }
 
-void exception16()
+
+static void ack_irq(int irq)
 {
-    catastrophic_isr(16);
+    if (ioapic_enabled)
+	lapic_eoi();
+    else {
+	/* acknowledge, on the slave controller too for IRQ 8-15 */
+	if (irq >= 8)
+	    outportb(0xA0, 0x20);
+	outportb(0x20, 0x20);
+    }
 }
 
 
-void isr_dummy();
-void dummy_isr() 
+static void handle_irq(int intr_no)
 {
-    asm ("isr_dummy:");
-    asm ("push %eax; push %ecx; push %edx");
-    asm ("push %ebx; push %ebp; push %esi; push %edi");
+    int irq = intr_no - IRQ_BASE;
+    BOOL served = FALSE;
 
-    /*  do nothing */
+    if (irq_handler[irq] != NULL) {
+	irq_handler[irq](intr_no);
+	served = TRUE;
+    }
+    if (irq_tasklet[irq] != NULL) {
+	schedule_tasklet(irq_tasklet[irq]);
+	served = TRUE;
+    }
 
-    asm ("movb  $0x20,%al");
-    asm ("outb  %al,$0x20");
-    asm ("pop %edi; pop %esi; pop %ebp; pop %ebx");
-    asm ("pop %edx; pop %ecx; pop %eax");
-    asm ("iret");
+    /* if processes are waiting for the interrupt, put them back on the ready queue */
+    count_irq(&irq_stats[irq], served || interrupt_table[intr_no] != NULL);
+    if (interrupt_table[intr_no] != NULL)
+	wake_waiters(intr_no);
+    ack_irq(irq);
 }
 
-// helper function used in isr
-void check() {
-    assert(active_proc->magic == MAGIC_PCB);
-}
 
 /*
- * Timer ISR
+ * Called from irq_common with the vector number and the stack pointer
+ * of the interrupted process. Wakes up the process waiting for the
+ * interrupt, acknowledges it and returns the stack pointer of the
+ * process to resume. A profiler sample resumes the interrupted process
+ * without a visit to the dispatcher, which would shorten its time slice.
  */
-void isr_timer ();
-void dummy_isr_timer ()
+MEM_ADDR irq_dispatch(int intr_no, MEM_ADDR esp)
 {
-    asm ("isr_timer:");
-    asm ("push %eax; push %ecx; push %edx");
-    asm ("push %ebx; push %ebp; push %esi; push %edi");
-
-    // enable preemption
-    asm ("movl %%esp,%0" : "=m" (active_proc->esp) : );
-
-    /* if a process is waiting for the interrupt, puts it back to the ready queue. */
-    p = interrupt_table[TIMER_IRQ];
-
-    if (p && p->state == STATE_INTR_BLOCKED) {
-       add_ready_queue(p);
+    kernel_lock_enter();
+    active_proc->esp = esp;
+    TRACE(TRACE_IRQ, active_proc, intr_no);
+    if (intr_no == RTC_IRQ) {
+	profile_irq(esp);
+	ack_irq(intr_no - IRQ_BASE);
+	return esp;
     }
+    if (intr_no == LAPIC_TIMER_VECTOR)
+	lapic_timer_irq();
+    else
+	handle_irq(intr_no);
 
+    run_tasklets();
     active_proc = dispatcher();
-    check();  
-    asm ("movl %0,%%esp" : : "m" (active_proc->esp));
-
-    asm ("movb  $0x20,%al");
-    asm ("outb  %al,$0x20");
-    asm ("pop %edi; pop %esi; pop %ebp; pop %ebx");
-    asm ("pop %edx; pop %ecx; pop %eax");
-    asm ("iret");
+    assert(active_proc->magic == MAGIC_PCB);
+    switch_address_space(active_proc);
+    return active_proc->esp;
 }
 
 
-
-/*
- * COM1 ISR
- */
-void isr_com1 ();
-void dummy_isr_com1 ()
+void check_valid_wait(int intr_no) 
 {
+    assert(IS_IRQ(intr_no));
 }
 
 
 /*
- * Keyboard ISR
+ * Waits for the interrupt intr_no. Interrupts that arrived while no
+ * process was waiting are returned at once without blocking, unless
+ * the line has a handler or tasklet that served them. Returns
+ * the number of interrupts delivered, which is more than one if several
+ * were coalesced. Any number of processes may wait for the same line;
+ * see set_irq_wake_mode() for which of them an interrupt wakes up.
  */
-void isr_keyb();
-void dummy_isr_keyb()
+int wait_for_interrupt (int intr_no)
 {
-    /*
-     *	PUSHL	%EAX		; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     */
-    asm ("isr_keyb:");
-    asm ("pushl %eax;pushl %ecx;pushl %edx");
-    asm ("pushl %ebx;pushl %ebp;pushl %esi;pushl %edi");
-
-    /* Save the context pointer ESP to the PCB */
-    asm ("movl %%esp,%0" : "=m" (active_proc->esp) : );
-
-    p = interrupt_table[KEYB_IRQ];
-
-    if (p == NULL) {
-	   panic ("service_intr_0x61: Spurious interrupt");
-    }
-
-    if (p->state != STATE_INTR_BLOCKED) {
-	   panic ("service_intr_0x61: No process waiting");
-    }
-
-    /* Add event handler to ready queue */
-    add_ready_queue (p);
-
-    active_proc = dispatcher();
-
-    /* Restore context pointer ESP */
-    asm ("movl %0,%%esp" : : "m" (active_proc->esp) );
-
-    /*
-     *	MOVB  $0x20,%AL	; Reset interrupt controller
-     *	OUTB  %AL,$0x20
-     *	POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *	IRET		; Return to new process
-     */
-    asm ("movb $0x20,%al;outb %al,$0x20");
-    asm ("popl %edi;popl %esi;popl %ebp;popl %ebx");
-    asm ("popl %edx;popl %ecx;popl %eax");
-    asm ("iret");
-}
-
-
-void check_valid_wait(int intr_no) 
-{
-    assert(interrupt_table[intr_no] == NULL); // only one process can wait
-    assert(intr_no == TIMER_IRQ || intr_no == COM1_IRQ || intr_no == KEYB_IRQ);
+    return wait_for_interrupt_timeout(intr_no, NO_TIMEOUT);
 }
 
 
-void wait_for_interrupt (int intr_no)
+/*
+ * Like wait_for_interrupt(), but gives up after ticks timer ticks
+ * (NO_TIMEOUT = wait forever). Returns 0 on timeout.
+ */
+int wait_for_interrupt_timeout (int intr_no, unsigned ticks)
 {
+    IRQ_STATS* s;
+    PROCESS* p;
+    int n;
     volatile int saved_if;
     DISABLE_INTR(saved_if);
 
     check_valid_wait(intr_no);
-    interrupt_table[intr_no] = active_proc; // record the wait
+    s = &irq_stats[intr_no - IRQ_BASE];
+    if (s->pending != 0) {
+        n = s->pending;
+        s->pending = 0;
+        ENABLE_INTR(saved_if);
+        return n;
+    }
+
+    // record the wait at the end of the line's wait list
+    for (p = &interrupt_table[intr_no]; *p != NULL; p = &(*p)->next_blocked)
+        ;
+    *p = active_proc;
+    active_proc->next_blocked = NULL;
+    active_proc->param_data = (void*) 0;   // stays 0 on timeout
 
     active_proc->state = STATE_INTR_BLOCKED;
+    if (ticks != NO_TIMEOUT)
+        add_timeout(active_proc, ticks);
     remove_ready_queue(active_proc);
     resign();
-    interrupt_table[intr_no] = NULL; // wait finishes
+    if (ticks != NO_TIMEOUT)
+        cancel_timeout(active_proc);
+    n = (int) active_proc->param_data;
 
     ENABLE_INTR(saved_if);
+    return n;
 }
 
 
@@ -313,7 +481,8 @@ void re_program_interrupt_controller ()
  * When the initialization is completed, it sets the global variable interrupts_initialized 
  * to true. As the last instruction, init_interrupts() enables the interrupts by executing 
  * the assembly instruction sti. 
- * init 256 entries array, only assign values to 3 entries
+ * Exceptions, the 16 PIC lines and the local APIC vectors get their
+ * entry stubs, all other vectors isr_dummy.
  */
 void init_interrupts()
 {
@@ -327,24 +496,19 @@ void init_interrupts()
         init_idt_entry(i, isr_dummy);
     }
 
-    init_idt_entry(0, exception0);
-    init_idt_entry(1, exception1);
-    init_idt_entry(2, exception2);
-    init_idt_entry(3, exception3);
-    init_idt_entry(4, exception4);
-    init_idt_entry(5, exception5);
-    init_idt_entry(6, exception6);
-    init_idt_entry(7, exception7);
-    init_idt_entry(8, exception8);
-    init_idt_entry(9, exception9);
-    init_idt_entry(10, exception10);
-    init_idt_entry(11, exception11);
-    init_idt_entry(12, exception12);
-    init_idt_entry(13, exception13);
-    init_idt_entry(14, exception14);
-    init_idt_entry(15, exception15);
-    init_idt_entry(16, exception16);
-    init_idt_entry (TIMER_IRQ, isr_timer);
+    for (i = 0; i < NUM_EXCEPTIONS; i++)
+        init_idt_entry(i, (void (*) (void)) ((MEM_ADDR) exc_stubs + i * STUB_SIZE));
+    for (i = 0; i < NUM_IRQS; i++) {
+        init_idt_entry(IRQ_BASE + i,
+                       (void (*) (void)) ((MEM_ADDR) irq_stubs + i * STUB_SIZE));
+        irq_handler[i] = NULL;
+        irq_tasklet[i] = NULL;
+        k_memset(&irq_stats[i], 0, sizeof(IRQ_STATS));
+    }
+    init_idt_entry(LAPIC_TIMER_VECTOR, lapic_timer_stub);
+    init_idt_entry(SPURIOUS_VECTOR, spurious_stub);
+    init_tasklets();
+    set_irq_handler(TIMER_IRQ, timer_irq);
 
     re_program_interrupt_controller();
     
@@ -352,6 +516,7 @@ void init_interrupts()
     for (i = 0; i < MAX_INTERRUPTS; i++) {
         interrupt_table[i] = NULL;
     }
+    irq_wake_all = ~0;
 
     interrupts_initialized = TRUE;
     asm ("sti");
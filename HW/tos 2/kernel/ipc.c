@@ -38,6 +38,7 @@ PORT create_new_port (PROCESS owner)
 		new_port->used = TRUE;
 		new_port->open = TRUE;
 		new_port->owner = owner;
+		new_port->posted = 0;
 
 		if(owner->first_port == NULL) {
 			new_port->next = NULL;			
@@ -84,14 +85,28 @@ void close_port (PORT port)
  *  }
  */
 void send (PORT dest_port, void* data)
+{
+	send_timeout(dest_port, data, NO_TIMEOUT);
+}
+
+/**
+ * Like send(), but gives up if the receiver has not replied within ticks
+ * timer ticks (NO_TIMEOUT = wait forever). Returns FALSE on timeout.
+ * A timed out sender may be taken off the send blocked list before the
+ * message was received, or give up waiting for the reply after it was;
+ * a late reply() is then ignored.
+ */
+BOOL send_timeout (PORT dest_port, void* data, unsigned ticks)
 {
 	PROCESS receiver;
+	BOOL delivered = TRUE;
 	volatile int saved_if;
 
 	DISABLE_INTR(saved_if);
 	check_valid_port(dest_port);
 	receiver = dest_port->owner;
 	check_valid_process(receiver);
+	TRACE(TRACE_SEND, active_proc, receiver - pcb);
 
 	if ((receiver->state == STATE_RECEIVE_BLOCKED) && (dest_port->open == TRUE)) {
 		// receiver is ready - received blocked. Message is delivered immediately
@@ -99,6 +114,7 @@ void send (PORT dest_port, void* data)
 		receiver->param_data = data; // pass the data
 		add_ready_queue(receiver);
 		active_proc->state = STATE_REPLY_BLOCKED;
+		active_proc->reply_from = receiver;
 	} else { // receiver is not ready. get on to the send block list of the port
 		active_proc->param_data = data; // save the data
 		add_to_block_list(dest_port, active_proc);
@@ -106,8 +122,39 @@ void send (PORT dest_port, void* data)
 	}	
 
 	//active_proc->param_data = data;
+	if (ticks != NO_TIMEOUT)
+		add_timeout(active_proc, ticks);
 	remove_ready_queue(active_proc);
 	resign();	 
+	if (ticks != NO_TIMEOUT) {
+		delivered = !active_proc->timed_out;
+		cancel_timeout(active_proc);
+	}
+	ENABLE_INTR(saved_if);
+	return delivered;
+}
+
+/**
+ * Posts an event to port. The owner receives it like a message whose
+ * sender is NULL and whose data is the port itself. post_event() never
+ * blocks, so it can be called from interrupt context (e.g. a tasklet).
+ * Events posted while the owner is not receive blocked are counted and
+ * received one by one later.
+ */
+void post_event (PORT port)
+{
+	PROCESS owner;
+	volatile int saved_if;
+
+	DISABLE_INTR(saved_if);
+	check_valid_port(port);
+	owner = port->owner;
+	if (port->open && owner->state == STATE_RECEIVE_BLOCKED) {
+		owner->param_proc = NULL;
+		owner->param_data = port;
+		add_ready_queue(owner);
+	} else
+		port->posted++;
 	ENABLE_INTR(saved_if);
 }
 
@@ -131,6 +178,7 @@ void message (PORT dest_port, void* data)
 	check_valid_port(dest_port);
 	receiver = dest_port->owner;
 	check_valid_process(receiver);
+	TRACE(TRACE_SEND, active_proc, receiver - pcb);
 
 	if ((receiver->state == STATE_RECEIVE_BLOCKED) && (dest_port->open == TRUE)) {
 		receiver->param_proc = active_proc;
@@ -163,6 +211,16 @@ void message (PORT dest_port, void* data)
  *	    Change to STATE_RECEIVED_BLOCKED;
  */
 void* receive (PROCESS* sender)
+{
+	return receive_timeout(sender, NO_TIMEOUT);
+}
+
+/**
+ * Like receive(), but gives up if no message arrives within ticks timer
+ * ticks (NO_TIMEOUT = wait forever). On timeout, *sender is set to NULL
+ * and NULL is returned.
+ */
+void* receive_timeout (PROCESS* sender, unsigned ticks)
 {
 	PORT port;
 	PROCESS source;
@@ -176,18 +234,28 @@ void* receive (PROCESS* sender)
 	// get the first available port
 	while(port != NULL) {
 		check_valid_port(port);
-		if(port->open && (port->blocked_list_head != NULL)) {
+		if(port->open &&
+		   (port->blocked_list_head != NULL || port->posted != 0)) {
 			break;
 		}
 		port = port->next;
 	}
 
+	if(port != NULL && port->posted != 0) {	// event pending
+		port->posted--;
+		*sender = NULL;
+		TRACE(TRACE_RECEIVE, active_proc, TRACE_NO_PROC);
+		ENABLE_INTR(saved_if);
+		return port;
+	}
+
 	if(port != NULL) {	// message pending
 		source = port->blocked_list_head;
 		check_valid_process(source);
 
 		*sender = source; // cannot be sender = &source
 		data = source->param_data;
+		TRACE(TRACE_RECEIVE, active_proc, source - pcb);
 		remove_from_block_list(port);
 
 		if(source->state == STATE_MESSAGE_BLOCKED) {
@@ -196,6 +264,8 @@ void* receive (PROCESS* sender)
 			return data;
 		} else if (source->state == STATE_SEND_BLOCKED) {
 			source->state = STATE_REPLY_BLOCKED; 
+			source->reply_from = active_proc;
+			TRACE(TRACE_STATE, source, STATE_REPLY_BLOCKED);
 			ENABLE_INTR(saved_if);
 			return data;			
 		}					
@@ -203,24 +273,39 @@ void* receive (PROCESS* sender)
 	// no message pending - no matter whether port is open or not
 	active_proc->param_data = data;
 	active_proc->state = STATE_RECEIVE_BLOCKED;
+	if (ticks != NO_TIMEOUT)
+		add_timeout(active_proc, ticks);
 	remove_ready_queue(active_proc);
 	resign();
     *sender = active_proc->param_proc; // data has already passed to receiver
     data = active_proc->param_data;
+    if (ticks != NO_TIMEOUT) {
+	if (active_proc->timed_out) {
+	    *sender = NULL;
+	    data = NULL;
+	}
+	cancel_timeout(active_proc);
+    }
+    TRACE(TRACE_RECEIVE, active_proc,
+	  *sender != NULL ? *sender - pcb : TRACE_NO_PROC);
     ENABLE_INTR(saved_if);
     return data;
 }
 
 /**
  * The receiver replies to a sender. The receiver must have previously received a 
- * message from the sender and the sender must be reply blocked.
+ * message from the sender and the sender must be reply blocked on it. A reply to a
+ * sender that has timed out, and may be blocked on somebody else by now, is ignored.
  */
 void reply (PROCESS sender)
 {
 	volatile int saved_if;
 
 	DISABLE_INTR(saved_if);
-	if (sender->state == STATE_REPLY_BLOCKED) {
+	TRACE(TRACE_REPLY, active_proc, sender - pcb);
+	if (sender->state == STATE_REPLY_BLOCKED &&
+	    sender->reply_from == active_proc) {
+		sender->reply_from = NULL;
 		add_ready_queue(sender);
 		resign();
 	}
@@ -262,6 +347,7 @@ void add_to_block_list(PORT port, PROCESS sender)
 		port->blocked_list_tail->next_blocked = sender;
 	port->blocked_list_tail = sender;
 	sender->next_blocked = NULL;
+	sender->blocked_port = port;
 
 	ENABLE_INTR(saved_if);
 }
@@ -0,0 +1,211 @@
+
+#include <kernel.h>
+
+/*
+ * Interrupts-off tracing
+ *
+ * When the kernel is built with -DTRACE_INTR_OFF, DISABLE_INTR() and
+ * ENABLE_INTR() call intr_off_begin() and intr_off_end(). A span starts
+ * when the outermost DISABLE_INTR() clears the interrupt flag and ends
+ * when the matching ENABLE_INTR() sets it again, or when resign()
+ * switches to another process in between. Nested pairs, whose saved
+ * flags already have interrupts off, are not counted separately.
+ *
+ * Spans are measured with the time-stamp counter and accumulated per
+ * call site. The site is the return address of intr_off_begin(), that
+ * is, the code right after the DISABLE_INTR() that opened the span.
+ * __FILE__ and __LINE__ are kept alongside for readability.
+ *
+ * Every CPU has its own open span. They are opened and closed with
+ * the kernel lock held, which also protects the site table.
+ */
+
+static INTR_OFF_SITE intr_off_site[MAX_INTR_OFF_SITES];
+static int num_intr_off_sites;
+static unsigned intr_off_overflow;	/* spans from sites not in the table */
+
+/* the open span of each CPU, if any */
+typedef struct {
+    BOOL        open;
+    unsigned    start;
+    MEM_ADDR    site;
+    const char* file;
+    int         line;
+} INTR_OFF_SPAN;
+
+static INTR_OFF_SPAN intr_off_span[MAX_CPUS];
+
+static BOOL have_tsc;
+
+
+static int save_and_cli()
+{
+    int flags;
+
+    asm volatile ("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static void restore_flags(int flags)
+{
+    asm volatile ("pushl %0; popfl" : : "r" (flags) : "memory", "cc");
+}
+
+/* closes the open span and charges it to its site */
+static void close_span(INTR_OFF_SPAN* span)
+{
+    unsigned cycles = read_tsc() - span->start;
+    INTR_OFF_SITE* s;
+    int i;
+
+    span->open = FALSE;
+    for (i = 0; i < num_intr_off_sites; i++)
+	if (intr_off_site[i].site == span->site)
+	    break;
+    if (i == num_intr_off_sites) {
+	if (i == MAX_INTR_OFF_SITES) {
+	    intr_off_overflow++;
+	    return;
+	}
+	s = &intr_off_site[num_intr_off_sites++];
+	s->site = span->site;
+	s->file = span->file;
+	s->line = span->line;
+	s->count = 0;
+	s->max_cycles = 0;
+	s->total_cycles = 0;
+    }
+    s = &intr_off_site[i];
+    s->count++;
+    s->total_cycles += cycles;
+    if (cycles > s->max_cycles)
+	s->max_cycles = cycles;
+}
+
+
+/*
+ * Called by DISABLE_INTR() with the flags it saved, after interrupts
+ * have been disabled.
+ */
+void intr_off_begin(int saved_flags, const char* file, int line)
+{
+    INTR_OFF_SPAN* span;
+
+    if (!have_tsc || !(saved_flags & EFLAGS_IF))
+	return;
+    span = &intr_off_span[this_cpu()->id];
+    span->open = TRUE;
+    span->site = (MEM_ADDR) __builtin_return_address(0);
+    span->file = file;
+    span->line = line;
+    span->start = read_tsc();
+}
+
+
+/*
+ * Called by ENABLE_INTR() with the flags it is about to restore,
+ * while interrupts are still disabled.
+ */
+void intr_off_end(int saved_flags)
+{
+    INTR_OFF_SPAN* span = &intr_off_span[this_cpu()->id];
+
+    if (span->open && (saved_flags & EFLAGS_IF))
+	close_span(span);
+}
+
+
+/*
+ * Called by resign() before it switches to another process. The next
+ * process restores its own flags, so the open span ends here.
+ */
+void intr_off_switch()
+{
+    INTR_OFF_SPAN* span = &intr_off_span[this_cpu()->id];
+
+    if (span->open)
+	close_span(span);
+}
+
+
+void reset_intr_off_stats()
+{
+    int flags = save_and_cli();
+    int i;
+
+    num_intr_off_sites = 0;
+    intr_off_overflow = 0;
+    for (i = 0; i < MAX_CPUS; i++)
+	intr_off_span[i].open = FALSE;
+    have_tsc = (cpu_features() & CPU_FEATURE_TSC) != 0;
+    restore_flags(flags);
+}
+
+
+/* n / d for a 64-bit n, without the libgcc helpers */
+static unsigned div64(unsigned long long n, unsigned d)
+{
+    unsigned long long q = 0, r = 0;
+    int i;
+
+    for (i = 63; i >= 0; i--) {
+	r = (r << 1) | ((n >> i) & 1);
+	if (r >= d) {
+	    r -= d;
+	    q |= 1ULL << i;
+	}
+    }
+    return (unsigned) q;
+}
+
+
+/*
+ * Prints the n sites with the longest interrupts-off spans, worst first
+ */
+void print_intr_off_stats(WINDOW* wnd, int n)
+{
+    INTR_OFF_SITE copy[MAX_INTR_OFF_SITES];
+    INTR_OFF_SITE tmp;
+    int num_sites, i, j, worst;
+    unsigned overflow;
+    int flags;
+
+#ifndef TRACE_INTR_OFF
+    wprintf(wnd, "Interrupts-off tracing is not built in "
+		 "(build with -DTRACE_INTR_OFF)\n");
+    return;
+#endif
+    if (!have_tsc) {
+	wprintf(wnd, "No time-stamp counter, nothing traced\n");
+	return;
+    }
+
+    flags = save_and_cli();
+    num_sites = num_intr_off_sites;
+    overflow = intr_off_overflow;
+    k_memcpy(copy, intr_off_site, num_sites * sizeof(INTR_OFF_SITE));
+    restore_flags(flags);
+
+    wprintf(wnd, "Site      Count     Max cyc   Avg cyc   Location\n");
+    for (i = 0; i < n && i < num_sites; i++) {
+	worst = i;
+	for (j = i + 1; j < num_sites; j++)
+	    if (copy[j].max_cycles > copy[worst].max_cycles)
+		worst = j;
+	tmp = copy[i];
+	copy[i] = copy[worst];
+	copy[worst] = tmp;
+	wprintf(wnd, "%08x  %-8d  %-8d  %-8d  %s:%d\n",
+		copy[i].site, copy[i].count, copy[i].max_cycles,
+		div64(copy[i].total_cycles, copy[i].count),
+		copy[i].file, copy[i].line);
+    }
+    if (overflow != 0)
+	wprintf(wnd, "%d spans from untracked sites\n", overflow);
+}
+
+
+void init_intr_off_stats()
+{
+    reset_intr_off_stats();
+}
@@ -281,6 +281,8 @@ void keyb_process (PROCESS self, PARAM param)
     keyb_notifier_port =
 	create_process (keyb_notifier, 7, 0, "Keyboard Notifier");
     keyb_notifier_proc = keyb_notifier_port->owner;
+    /* run where the keyboard interrupt arrives */
+    set_affinity(keyb_notifier_proc, CPU_MASK(irq_cpu(KEYB_IRQ)));
 
     client_proc = NULL;
     client_msg = NULL;
@@ -329,5 +331,7 @@ void init_keyb()
 {
     keyb_port = create_process (keyb_process, 6, 0,
 				"Keyboard Process");
+    set_affinity(keyb_port->owner, CPU_MASK(irq_cpu(KEYB_IRQ)));
+    register_port("keyboard", keyb_port);
     resign();
 }
@@ -2,7 +2,11 @@
 #include <kernel.h>
 
 
-void kernel_main()
+/*
+ * The boot loader passes the BIOS memory map in %ebx. Other loaders
+ * leave %ebx undefined; init_page_frames() checks the map's magic.
+ */
+void kernel_main(MEMORY_MAP* memory_map)
 {
     // this turns off the VGA hardware cursor
     // otherwise we get an annoying, meaningless,
@@ -12,11 +16,19 @@ void kernel_main()
     outportb(0x03D4, 0x0F);
     outportb(0x03D5, 0xFF);
 
+    init_intr_off_stats();
+    init_heap();
+    init_page_frames(memory_map);
+    init_paging();
     init_process();
     init_dispatcher();
     init_ipc();
+    init_names();
+    init_channels();
     init_interrupts();
+    init_fpu();
     init_null_process();
+    init_smp();
     init_timer();
     init_com();
     init_keyb();
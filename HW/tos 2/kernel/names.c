@@ -0,0 +1,182 @@
+
+#include <kernel.h>
+
+/*
+ * Name service
+ *
+ * Maps service names to ports in an open-addressing hash table with
+ * linear probing. Names are hashed with FNV-1a. Removed entries are
+ * left as tombstones so that probe sequences stay intact.
+ *
+ * Clients that look up the same service repeatedly keep a PORT_REF.
+ * lookup_port_cached() returns the port stored in it without hashing
+ * for as long as name_generation is unchanged. The generation is bumped
+ * whenever an existing binding changes or disappears.
+ */
+
+#define FNV_OFFSET	2166136261u
+#define FNV_PRIME	16777619u
+
+#define SLOT_FREE	0
+#define SLOT_USED	1
+#define SLOT_REMOVED	2
+
+typedef struct {
+    unsigned state;
+    unsigned hash;
+    char     name[MAX_NAME_LEN + 1];
+    PORT     port;
+} NAME_ENTRY;
+
+static NAME_ENTRY name_table[NAME_TABLE_SIZE];
+static int num_names;
+
+unsigned name_generation;
+
+
+static unsigned hash_name(const char* name)
+{
+    unsigned h = FNV_OFFSET;
+
+    while (*name != '\0') {
+	h ^= (unsigned char) *name++;
+	h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static BOOL name_equal(const char* a, const char* b)
+{
+    while (*a != '\0' && *a == *b) {
+	a++;
+	b++;
+    }
+    return *a == *b;
+}
+
+/* entry bound to name, or NULL */
+static NAME_ENTRY* find_name(const char* name, unsigned hash)
+{
+    NAME_ENTRY* e;
+    int i, n;
+
+    i = hash & (NAME_TABLE_SIZE - 1);
+    for (n = 0; n < NAME_TABLE_SIZE; n++) {
+	e = &name_table[i];
+	if (e->state == SLOT_FREE)
+	    return NULL;
+	if (e->state == SLOT_USED && e->hash == hash && name_equal(e->name, name))
+	    return e;
+	i = (i + 1) & (NAME_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+
+/*
+ * Binds name to port. An existing binding of the same name is
+ * replaced. Returns FALSE if the name is too long or the table is full.
+ */
+BOOL register_port(const char* name, PORT port)
+{
+    NAME_ENTRY* e;
+    unsigned hash;
+    int i;
+    volatile int saved_if;
+
+    if (k_strlen(name) > MAX_NAME_LEN)
+	return FALSE;
+    hash = hash_name(name);
+
+    DISABLE_INTR(saved_if);
+    e = find_name(name, hash);
+    if (e != NULL) {
+	e->port = port;
+	name_generation++;
+	ENABLE_INTR(saved_if);
+	return TRUE;
+    }
+    /* keep the table at most 3/4 full so that probe sequences stay short */
+    if (num_names >= NAME_TABLE_SIZE * 3 / 4) {
+	ENABLE_INTR(saved_if);
+	return FALSE;
+    }
+    i = hash & (NAME_TABLE_SIZE - 1);
+    while (name_table[i].state == SLOT_USED)
+	i = (i + 1) & (NAME_TABLE_SIZE - 1);
+    e = &name_table[i];
+    e->state = SLOT_USED;
+    e->hash = hash;
+    k_memcpy(e->name, name, k_strlen(name) + 1);
+    e->port = port;
+    num_names++;
+    ENABLE_INTR(saved_if);
+    return TRUE;
+}
+
+
+/*
+ * Removes the binding of name, if any.
+ */
+void unregister_port(const char* name)
+{
+    NAME_ENTRY* e;
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    e = find_name(name, hash_name(name));
+    if (e != NULL) {
+	e->state = SLOT_REMOVED;
+	e->port = NULL;
+	num_names--;
+	name_generation++;
+    }
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Returns the port bound to name, or NULL.
+ */
+PORT lookup_port(const char* name)
+{
+    NAME_ENTRY* e;
+    PORT port = NULL;
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    e = find_name(name, hash_name(name));
+    if (e != NULL)
+	port = e->port;
+    ENABLE_INTR(saved_if);
+    return port;
+}
+
+
+/*
+ * Returns the port bound to ref->name, using the port cached in ref
+ * when no binding has changed since it was looked up.
+ */
+PORT lookup_port_cached(PORT_REF* ref)
+{
+    unsigned generation = name_generation;
+
+    if (ref->port != NULL && ref->generation == generation)
+	return ref->port;
+    ref->port = lookup_port(ref->name);
+    ref->generation = generation;
+    return ref->port;
+}
+
+
+void init_names()
+{
+    int i;
+
+    for (i = 0; i < NAME_TABLE_SIZE; i++) {
+	name_table[i].state = SLOT_FREE;
+	name_table[i].port = NULL;
+    }
+    num_names = 0;
+    name_generation++;
+}
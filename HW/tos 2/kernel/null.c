@@ -3,11 +3,17 @@
 
 
 void null_process(PROCESS self, PARAM param) {
-	while (1) ;
+	while (1)
+		if (steal_work())
+			resign();
 }
 
 
 void init_null_process()
 {
-	create_process(null_process, 0, 0, 'null process');
+	PROCESS idle;
+
+	idle = create_process(null_process, 0, 0, "null process")->owner;
+	idle->affinity = CPU_MASK(idle->cpu);
+	this_cpu()->idle = idle;
 }
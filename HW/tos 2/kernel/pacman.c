@@ -4,6 +4,9 @@
 #define MAZE_WIDTH  19
 #define MAZE_HEIGHT 16
 #define GHOST_CHAR  0x02
+#define MAZE_COLOR  MAKE_COLOR(VGA_LIGHT_BLUE, VGA_BLACK)
+#define GHOST_COLOR MAKE_COLOR(VGA_LIGHT_RED, VGA_BLACK)
+#define GHOST_PERIOD 3		/* timer ticks per ghost move */
 
 typedef struct {
     int x;
@@ -12,6 +15,7 @@ typedef struct {
 
 
 WINDOW* pacman_wnd;
+CELL pacman_backing[MAZE_WIDTH * (MAZE_HEIGHT + 1)];
 
 
 
@@ -36,7 +40,7 @@ char *maze[] = {
 };
 
 
-void draw_maze_char(char maze_char)
+CELL maze_cell(char maze_char)
 {
     char ch = ' ';
     
@@ -74,7 +78,7 @@ void draw_maze_char(char maze_char)
         	ch = 0xB4;
         	break;
     }
-    output_char(pacman_wnd, ch);
+    return MAKE_CELL(ch, MAZE_COLOR);
 }
 
 
@@ -82,6 +86,7 @@ void draw_maze_char(char maze_char)
 void draw_maze()
 {
     int x, y;
+    CELL cells[MAZE_WIDTH];
     
     clear_window(pacman_wnd);
     y = 0;
@@ -89,12 +94,14 @@ void draw_maze()
     	char* row = maze[y];
     	x = 0;
     	while (row[x] != '\0') {
-    	    char ch = row[x];
-    	    draw_maze_char(ch);
+    	    cells[x] = maze_cell(row[x]);
     	    x++;
     	}
+    	// paint the whole row with a single span
+    	output_cells(pacman_wnd, 0, y, cells, x);
     	y++;
     }
+    move_cursor(pacman_wnd, 0, y);
     wprintf(pacman_wnd, "PacMan ");
 }
 
@@ -148,6 +155,8 @@ void choose_random_direction(int* dx, int* dy)
 
 BOOL move_ghost(GHOST* ghost, int dx, int dy)
 {
+    static const CELL blank = MAKE_CELL(' ', MAZE_COLOR);
+    static const CELL ghost_cell = MAKE_CELL(GHOST_CHAR, GHOST_COLOR);
     int old_x = ghost->x;
     int old_y = ghost->y;
     int new_x = old_x + dx;
@@ -155,10 +164,8 @@ BOOL move_ghost(GHOST* ghost, int dx, int dy)
     if (maze[new_y][new_x] != ' ')
 	// Don't run into a wall
 	return FALSE;
-    move_cursor(pacman_wnd, old_x, old_y);
-    remove_cursor(pacman_wnd);
-    move_cursor(pacman_wnd, new_x, new_y);
-    show_cursor(pacman_wnd);
+    output_cells(pacman_wnd, old_x, old_y, &blank, 1);
+    output_cells(pacman_wnd, new_x, new_y, &ghost_cell, 1);
     ghost->x = new_x;
     ghost->y = new_y;
     return TRUE;
@@ -168,14 +175,15 @@ BOOL move_ghost(GHOST* ghost, int dx, int dy)
 void create_new_ghost()
 {
     GHOST ghost;
+    PERIODIC_TIMER step;
     int dx, dy;
 
     init_ghost(&ghost);
     choose_random_direction(&dx, &dy);
     
+    init_periodic_timer(&step, GHOST_PERIOD);
     while (1) {
-	int delay;
-	for (delay = 0; delay < 1000000; delay++) ;
+	wait_periodic_timer(&step);
 	while (move_ghost(&ghost, dx, dy) == FALSE)
 	    choose_random_direction(&dx, &dy);
     }
@@ -190,6 +198,7 @@ void init_pacman(WINDOW* wnd, int num_ghosts)
     pacman_wnd->width = MAZE_WIDTH;
     pacman_wnd->height = MAZE_HEIGHT + 1;
     pacman_wnd->cursor_char = GHOST_CHAR;
+    open_window(pacman_wnd, pacman_backing);
 
     draw_maze();
 
@@ -0,0 +1,301 @@
+
+#include <kernel.h>
+
+/*
+ * Paging
+ *
+ * The kernel page directory identity-maps all RAM known to the page
+ * frame allocator (up to IDENTITY_MAP_END), so that physical and linear
+ * addresses stay the same for kernel code. Page tables live in frames
+ * from the frame allocator and are therefore covered by the identity
+ * map themselves.
+ *
+ * A process with its own address space gets a page directory whose
+ * kernel part points to the same page tables as the kernel page
+ * directory; only the part from USER_SPACE_BASE upwards is private.
+ * Kernel mappings are marked global when the CPU supports it, so that
+ * they survive CR3 reloads.
+ *
+ * A process without an address space (page_dir == 0) only touches
+ * kernel memory, which looks the same in every page directory. Such
+ * a process simply runs in whatever address space is loaded, which
+ * saves the CR3 reload (and the TLB flush) when switching to it.
+ *
+ * Each CPU remembers the page directory it has loaded in its CPU_DEF.
+ * Device registers are mapped uncached into the MMIO window, the last
+ * page table of the kernel part.
+ */
+
+#define PDE_SHIFT		22
+#define ENTRIES_PER_TABLE	1024
+#define PAGE_ADDR_MASK		(~(PAGE_SIZE - 1))
+
+#define CR0_PG			0x80000000
+#define CR0_WP			0x00010000
+#define CR4_PGE			0x00000080
+
+
+BOOL paging_enabled = FALSE;
+
+static MEM_ADDR kernel_page_dir;
+static unsigned global_flag;
+static MEM_ADDR mmio_next = MMIO_BASE;
+
+
+static void load_cr3(MEM_ADDR page_dir)
+{
+    asm volatile ("movl %0,%%cr3" : : "r" (page_dir) : "memory");
+    this_cpu()->page_dir = page_dir;
+}
+
+static void invalidate_page(MEM_ADDR addr)
+{
+    asm volatile ("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+static MEM_ADDR alloc_zeroed_frame()
+{
+    MEM_ADDR frame = alloc_page_frame();
+
+    if (frame != 0)
+	k_memset((void*) frame, 0, PAGE_SIZE);
+    return frame;
+}
+
+/* page table entry for addr in page_dir, or NULL if there is no table */
+static LONG* lookup_pte(MEM_ADDR page_dir, MEM_ADDR addr)
+{
+    LONG pde = ((LONG*) page_dir)[addr >> PDE_SHIFT];
+
+    if (!(pde & PAGE_PRESENT))
+	return NULL;
+    return (LONG*) (pde & PAGE_ADDR_MASK) +
+	((addr >> PAGE_SHIFT) & (ENTRIES_PER_TABLE - 1));
+}
+
+
+/*
+ * Creates a new address space and returns the physical address of its
+ * page directory, or 0 if paging is off or memory is exhausted.
+ */
+MEM_ADDR create_address_space()
+{
+    MEM_ADDR page_dir;
+
+    if (!paging_enabled || (page_dir = alloc_zeroed_frame()) == 0)
+	return 0;
+    k_memcpy((void*) page_dir, (void*) kernel_page_dir,
+	     (USER_SPACE_BASE >> PDE_SHIFT) * sizeof(LONG));
+    return page_dir;
+}
+
+
+/*
+ * Releases the page directory and the user page tables of an address
+ * space. Frames mapped into it are not freed; they belong to the caller.
+ */
+void destroy_address_space(MEM_ADDR page_dir)
+{
+    LONG* dir = (LONG*) page_dir;
+    unsigned i;
+
+    for (i = 0; i < num_cpus; i++)
+	assert(page_dir != cpus[i].page_dir);
+    for (i = USER_SPACE_BASE >> PDE_SHIFT; i < ENTRIES_PER_TABLE; i++)
+	if (dir[i] & PAGE_PRESENT)
+	    free_page_frame(dir[i] & PAGE_ADDR_MASK);
+    free_page_frame(page_dir);
+}
+
+
+/*
+ * Maps the page at virt to the frame at phys in the user part of an
+ * address space. Returns FALSE if a page table could not be allocated.
+ */
+BOOL map_page(MEM_ADDR page_dir, MEM_ADDR virt, MEM_ADDR phys, unsigned flags)
+{
+    LONG* dir = (LONG*) page_dir;
+    LONG* pte;
+    MEM_ADDR table;
+    volatile int saved_if;
+
+    assert(virt >= USER_SPACE_BASE);
+    DISABLE_INTR(saved_if);
+    pte = lookup_pte(page_dir, virt);
+    if (pte == NULL) {
+	if ((table = alloc_zeroed_frame()) == 0) {
+	    ENABLE_INTR(saved_if);
+	    return FALSE;
+	}
+	dir[virt >> PDE_SHIFT] = table | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+	pte = lookup_pte(page_dir, virt);
+    }
+    *pte = (phys & PAGE_ADDR_MASK) | (flags & ~PAGE_GLOBAL) | PAGE_PRESENT;
+    if (page_dir == this_cpu()->page_dir)
+	invalidate_page(virt);
+    ENABLE_INTR(saved_if);
+    return TRUE;
+}
+
+
+/*
+ * Makes the other CPUs that have page_dir loaded reload CR3 the next
+ * time they switch to a process using it, rather than run it with a
+ * stale TLB entry. A CPU only uses the user part of page_dir while it
+ * runs one of its processes, and none of them is running elsewhere.
+ */
+static void forget_page_dir(MEM_ADDR page_dir)
+{
+    unsigned i;
+
+    for (i = 0; i < num_cpus; i++)
+	if (&cpus[i] != this_cpu() && cpus[i].page_dir == page_dir)
+	    cpus[i].page_dir = 0;
+}
+
+
+/*
+ * Removes the mapping of virt and returns the frame it was mapped to,
+ * or 0 if it was not mapped.
+ */
+MEM_ADDR unmap_page(MEM_ADDR page_dir, MEM_ADDR virt)
+{
+    LONG* pte;
+    MEM_ADDR phys = 0;
+    volatile int saved_if;
+
+    assert(virt >= USER_SPACE_BASE);
+    DISABLE_INTR(saved_if);
+    pte = lookup_pte(page_dir, virt);
+    if (pte != NULL && (*pte & PAGE_PRESENT)) {
+	phys = *pte & PAGE_ADDR_MASK;
+	*pte = 0;
+	forget_page_dir(page_dir);
+	if (page_dir == this_cpu()->page_dir)
+	    invalidate_page(virt);
+    }
+    ENABLE_INTR(saved_if);
+    return phys;
+}
+
+
+/*
+ * Returns the physical address virt is mapped to in page_dir, or 0
+ * if it is not mapped.
+ */
+MEM_ADDR lookup_page(MEM_ADDR page_dir, MEM_ADDR virt)
+{
+    LONG* pte = lookup_pte(page_dir, virt);
+
+    if (pte == NULL || !(*pte & PAGE_PRESENT))
+	return 0;
+    return (*pte & PAGE_ADDR_MASK) | (virt & (PAGE_SIZE - 1));
+}
+
+
+/*
+ * Called with interrupts disabled by resign() and the ISRs after the
+ * dispatcher has picked proc.
+ */
+void switch_address_space(PROCESS proc)
+{
+    if (proc->page_dir != 0 && proc->page_dir != this_cpu()->page_dir)
+	load_cr3(proc->page_dir);
+}
+
+
+/*
+ * Maps size bytes of device registers at phys into the MMIO window and
+ * returns their linear address. Without paging that is phys itself.
+ * Mappings are never removed.
+ */
+MEM_ADDR map_mmio(MEM_ADDR phys, unsigned size)
+{
+    LONG* pte;
+    MEM_ADDR virt, offset, addr;
+    volatile int saved_if;
+
+    if (!paging_enabled)
+	return phys;
+    offset = phys & (PAGE_SIZE - 1);
+    phys -= offset;
+    size = (offset + size + PAGE_SIZE - 1) & PAGE_ADDR_MASK;
+    DISABLE_INTR(saved_if);
+    assert(mmio_next + size <= USER_SPACE_BASE);
+    virt = mmio_next;
+    mmio_next += size;
+    ENABLE_INTR(saved_if);
+    for (addr = 0; addr < size; addr += PAGE_SIZE) {
+	pte = lookup_pte(kernel_page_dir, virt + addr);
+	*pte = (phys + addr) | PAGE_PRESENT | PAGE_WRITABLE |
+	       PAGE_NO_CACHE | PAGE_WRITE_THROUGH | global_flag;
+    }
+    return virt + offset;
+}
+
+
+/* turns on paging with the kernel page directory on the calling CPU */
+static void enable_paging()
+{
+    unsigned cr0, cr4;
+
+    load_cr3(kernel_page_dir);
+    asm volatile ("movl %%cr0,%0" : "=r" (cr0));
+    /* WP makes read-only pages read-only for the kernel as well */
+    asm volatile ("movl %0,%%cr0" : : "r" (cr0 | CR0_PG | CR0_WP) : "memory");
+    if (global_flag) {
+	asm volatile ("movl %%cr4,%0" : "=r" (cr4));
+	asm volatile ("movl %0,%%cr4" : : "r" (cr4 | CR4_PGE) : "memory");
+    }
+}
+
+
+/*
+ * Called by an application processor before it touches memory that is
+ * only mapped with paging on, such as the local APIC
+ */
+void init_paging_ap()
+{
+    if (paging_enabled)
+	enable_paging();
+}
+
+
+void init_paging()
+{
+    MEM_ADDR top, table, addr;
+    LONG* dir;
+    LONG* pte;
+    unsigned i, j, kernel_pdes;
+
+    top = get_memory_top();
+    if (top == 0)
+	/* no memory above 1MB for page tables */
+	return;
+    assert(top <= IDENTITY_MAP_END);
+    if (cpu_features() & CPU_FEATURE_PGE)
+	global_flag = PAGE_GLOBAL;
+
+    kernel_page_dir = alloc_zeroed_frame();
+    assert(kernel_page_dir != 0);
+    dir = (LONG*) kernel_page_dir;
+    kernel_pdes = (top + (1 << PDE_SHIFT) - 1) >> PDE_SHIFT;
+    for (i = 0; i < kernel_pdes; i++) {
+	table = alloc_zeroed_frame();
+	assert(table != 0);
+	pte = (LONG*) table;
+	for (j = 0; j < ENTRIES_PER_TABLE; j++) {
+	    addr = (i << PDE_SHIFT) | (j << PAGE_SHIFT);
+	    if (addr < top)
+		pte[j] = addr | PAGE_PRESENT | PAGE_WRITABLE | global_flag;
+	}
+	dir[i] = table | PAGE_PRESENT | PAGE_WRITABLE;
+    }
+    /* the MMIO window's table, shared like the rest of the kernel part */
+    table = alloc_zeroed_frame();
+    assert(table != 0);
+    dir[MMIO_BASE >> PDE_SHIFT] = table | PAGE_PRESENT | PAGE_WRITABLE;
+
+    enable_paging();
+    paging_enabled = TRUE;
+}
@@ -28,23 +28,35 @@ PORT create_process (void (*ptr_to_new_proc) (PROCESS, PARAM),
 	assert(prio < MAX_READY_QUEUES);
 	assert(next_free_pcb != NULL); // pcbs are not all used
 
-	new_port = create_new_port(new_proc);
 	new_proc = next_free_pcb;
 	next_free_pcb = new_proc -> next; 
+	new_proc->magic = MAGIC_PCB;
+	new_proc->first_port = NULL;
+	new_port = create_new_port(new_proc);
+	new_proc->affinity = ALL_CPUS;
+	new_proc->cpu = pick_cpu(ALL_CPUS);
+	new_proc->edf_period = 0;
+	new_proc->edf_left = 0;
+	new_proc->edf_misses = 0;
+	new_proc->fpu_used = FALSE;
+	new_proc->fpu_cpu = -1;
 	ENABLE_INTR(saved_if);
 
-	new_proc->magic = MAGIC_PCB;
 	new_proc->used = TRUE;
 	new_proc->state = STATE_READY;
 	new_proc->priority = prio;
 	new_proc->first_port = new_port;
 	new_proc->name = name;
+	new_proc->page_dir = 0;
+	new_proc->grant_slots = 0;
+	new_proc->next_timeout = NULL;
+	new_proc->timed_out = FALSE;
+	new_proc->reply_from = NULL;
 
-	
 
 	// new_proc->esp = 640 - (new_proc - pcb) * 30;
 	/* Compute linear address of new process' system stack */
-    esp = (640 - (new_proc - pcb) * 16) * 1024;
+    esp = STACK_TOP - (new_proc - pcb) * STACK_SIZE;
 
 // define macro, '\' is line slicing for preprocessing
 #define PUSH(x)    esp -= 4; \
@@ -98,14 +110,17 @@ void print_process_info(WINDOW* wnd, PROCESS p)
 	  "REPLY_BLOCKED  ",
 	  "RECEIVE_BLOCKED",
 	  "MESSAGE_BLOCKED",
-	  "INTR_BLOCKED   "
+	  "INTR_BLOCKED   ",
+	  "CHANNEL_BLOCKED",
+	  "SYNC_BLOCKED   ",
+	  "PERIOD_BLOCKED "
 	};
 	
 	wprintf(wnd, "%-25s", p->name);
 	wprintf(wnd, "%-22s", state[p->state]);
 	wprintf(wnd, "%-5d", p->priority);
-	/* Check for active_proc */
-    if (p == active_proc) wprintf(wnd, "  *  ");
+	/* Check for active_proc, on whichever CPU it runs */
+    if (p == cpus[p->cpu].current) wprintf(wnd, "  *  ");
 	wprintf(wnd, "\n");
 }
 
@@ -170,4 +185,17 @@ void init_process()
 	pcb[0].priority = 1;
 	pcb[0].first_port = NULL; // why NULL?
 	pcb[0].name = "Boot process";
+	pcb[0].page_dir = 0;
+	pcb[0].grant_slots = 0;
+	pcb[0].next_timeout = NULL;
+	pcb[0].timed_out = FALSE;
+	pcb[0].reply_from = NULL;
+	pcb[0].cpu = this_cpu()->id;
+	pcb[0].affinity = ALL_CPUS;
+	pcb[0].edf_period = 0;
+	pcb[0].edf_left = 0;
+	pcb[0].edf_misses = 0;
+	pcb[0].fpu_used = FALSE;
+	pcb[0].fpu_cpu = -1;
+	init_timeouts();
 }
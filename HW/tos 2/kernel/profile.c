@@ -0,0 +1,217 @@
+
+#include <kernel.h>
+
+/*
+ * Sampling profiler
+ *
+ * While the profiler runs, the real-time clock interrupts PROFILE_HZ
+ * times a second, and each interrupt records where the process it
+ * interrupted was: a bucket per process and address counts how often
+ * that process was caught at that EIP. The shell's profile command
+ * shows the busiest addresses, and sends the buckets over COM2, where
+ * tools/profile maps them to functions with the symbols of tos.elf.
+ *
+ * The RTC is used because the PIT and the local APIC timers only tick
+ * TIMER_HZ times a second. Its interrupt only takes a sample; it does
+ * not run the dispatcher, so time slices stay as they are.
+ *
+ * Code that runs with interrupts off cannot be sampled. Its time is
+ * charged to the instruction that turns them back on. With more than
+ * one CPU, only the CPU the RTC interrupt is routed to is sampled (see
+ * set_irq_cpu()).
+ */
+
+#define PROFILE_BUCKETS		4096		/* 48K, a power of 2 */
+
+#define CMOS_SELECT		0x70
+#define CMOS_DATA		0x71
+#define RTC_STATUS_A		0x0A
+#define RTC_STATUS_B		0x0B
+#define RTC_STATUS_C		0x0C
+#define RTC_RATE_MASK		0x0F
+#define RTC_RATE_1024_HZ	6		/* 32768 >> (rate - 1) Hz */
+#define RTC_PERIODIC		0x40		/* periodic interrupt enable */
+
+/* the EIP in the frame irq_common builds: edi ... eax, eip, cs, eflags */
+#define FRAME_EIP		(7 * 4)
+
+static PROFILE_BUCKET* profile_buckets;
+static volatile BOOL profile_on;
+static unsigned profile_samples;
+static unsigned profile_dropped;
+
+
+static BYTE cmos_read(BYTE reg)
+{
+    outportb(CMOS_SELECT, reg);
+    return inportb(CMOS_DATA);
+}
+
+static void cmos_write(BYTE reg, BYTE value)
+{
+    outportb(CMOS_SELECT, reg);
+    outportb(CMOS_DATA, value);
+}
+
+
+/* the bucket for proc at eip, a new one if there is none yet, or NULL */
+static PROFILE_BUCKET* find_bucket(unsigned proc, MEM_ADDR eip)
+{
+    PROFILE_BUCKET* b;
+    unsigned i, n;
+
+    i = ((eip ^ (proc << 24)) * 2654435761U) >> 20;
+    for (n = 0; n < PROFILE_BUCKETS; n++, i = (i + 1) % PROFILE_BUCKETS) {
+	b = &profile_buckets[i];
+	if (b->count == 0) {
+	    b->eip = eip;
+	    b->proc = proc;
+	    return b;
+	}
+	if (b->eip == eip && b->proc == proc)
+	    return b;
+    }
+    return NULL;
+}
+
+
+/*
+ * Called by irq_dispatch() for RTC_IRQ, with the kernel lock held and
+ * the stack pointer of the interrupted process
+ */
+void profile_irq(MEM_ADDR esp)
+{
+    PROFILE_BUCKET* b;
+
+    /* reading status register C lets the RTC interrupt again */
+    cmos_read(RTC_STATUS_C);
+    if (!profile_on)
+	return;
+    profile_samples++;
+    b = find_bucket(active_proc - pcb, *((MEM_ADDR*) (esp + FRAME_EIP)));
+    if (b != NULL)
+	b->count++;
+    else
+	profile_dropped++;
+}
+
+
+/*
+ * Clears the profile and starts sampling. Returns FALSE if there is no
+ * memory for the buckets.
+ */
+BOOL profile_start()
+{
+    volatile int saved_if;
+
+    if (profile_buckets == NULL &&
+	(profile_buckets = k_malloc(PROFILE_BUCKETS * sizeof(PROFILE_BUCKET))) == NULL)
+	return FALSE;
+
+    DISABLE_INTR(saved_if);
+    k_memset(profile_buckets, 0, PROFILE_BUCKETS * sizeof(PROFILE_BUCKET));
+    profile_samples = 0;
+    profile_dropped = 0;
+    profile_on = TRUE;
+    cmos_write(RTC_STATUS_A,
+	       (cmos_read(RTC_STATUS_A) & ~RTC_RATE_MASK) | RTC_RATE_1024_HZ);
+    cmos_write(RTC_STATUS_B, cmos_read(RTC_STATUS_B) | RTC_PERIODIC);
+    /* an interrupt that is already flagged would never be delivered */
+    cmos_read(RTC_STATUS_C);
+    ENABLE_INTR(saved_if);
+    return TRUE;
+}
+
+
+/* Stops sampling; the profile is kept until the next profile_start() */
+void profile_stop()
+{
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    profile_on = FALSE;
+    cmos_write(RTC_STATUS_B, cmos_read(RTC_STATUS_B) & ~RTC_PERIODIC);
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * The name of pcb[proc], or NULL if the PCB is free. A bucket outlives
+ * its process, so its PCB may have been reused or cleared since.
+ */
+static const char* proc_name(unsigned proc)
+{
+    if (!pcb[proc].used || pcb[proc].magic != MAGIC_PCB)
+	return NULL;
+    return pcb[proc].name;
+}
+
+
+/* does bucket a come before bucket b in the order of print_profile()? */
+static BOOL busier(PROFILE_BUCKET* a, PROFILE_BUCKET* b)
+{
+    return a->count > b->count || (a->count == b->count && a < b);
+}
+
+/*
+ * Prints the n buckets with the most samples. Without the symbols the
+ * addresses are raw; tools/profile names the functions.
+ */
+void print_profile(WINDOW* wnd, int n)
+{
+    PROFILE_BUCKET *b, *best, *last = NULL;
+    int i;
+
+    if (profile_buckets == NULL || profile_samples == 0) {
+	wprintf(wnd, "No samples\n");
+	return;
+    }
+    wprintf(wnd, "%d samples, %d dropped\n", profile_samples, profile_dropped);
+    wprintf(wnd, "EIP       Samples  %%    Process\n");
+    while (n-- > 0) {
+	/* the busiest bucket after the last one printed */
+	best = NULL;
+	for (i = 0, b = profile_buckets; i < PROFILE_BUCKETS; i++, b++)
+	    if (b->count != 0 && (last == NULL || busier(last, b)) &&
+		(best == NULL || busier(b, best)))
+		best = b;
+	if (best == NULL)
+	    break;
+	wprintf(wnd, "%08x  %-7d  %-3d  %s\n", best->eip, best->count,
+		best->count * 100 / profile_samples,
+		proc_name(best->proc) != NULL ? proc_name(best->proc) : "-");
+	last = best;
+    }
+}
+
+
+/*
+ * Stops sampling and sends the profile over COM2 by polling
+ */
+void profile_dump()
+{
+    PROFILE_HEADER header;
+    PROFILE_BUCKET* b;
+    int i;
+
+    profile_stop();
+    k_memcpy(header.magic, PROFILE_MAGIC, sizeof(header.magic));
+    header.version = PROFILE_VERSION;
+    header.hz = PROFILE_HZ;
+    header.num_procs = MAX_PROCS;
+    header.num_buckets = 0;
+    if (profile_buckets != NULL)
+	for (i = 0, b = profile_buckets; i < PROFILE_BUCKETS; i++, b++)
+	    if (b->count != 0)
+		header.num_buckets++;
+    header.samples = profile_samples;
+    header.dropped = profile_dropped;
+
+    init_dump_port();
+    dump_write(&header, sizeof(header));
+    dump_proc_names(PROFILE_NAME_LEN);
+    if (header.num_buckets != 0)
+	for (i = 0, b = profile_buckets; i < PROFILE_BUCKETS; i++, b++)
+	    if (b->count != 0)
+		dump_write(b, sizeof(PROFILE_BUCKET));
+}
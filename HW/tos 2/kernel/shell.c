@@ -1,8 +1,205 @@
+
 #include <kernel.h>
 
+/*
+ * A minimal command shell
+ *
+ * Reads a line from the keyboard process and runs the command named by
+ * its first word. New commands are added to shell_command[].
+ */
+
+#define SHELL_LINE_LEN		78
+
+static WINDOW shell_wnd = {0, 9, 80, 16, 0, 0, 0xDC};
+
+typedef struct {
+    const char* name;
+    void      (*func)(WINDOW* wnd, char* args);
+    const char* help;
+} SHELL_COMMAND;
+
+static void cmd_help(WINDOW* wnd, char* args);
+
+
+static BOOL str_equal(const char* a, const char* b)
+{
+    while (*a != '\0' && *a == *b) {
+	a++;
+	b++;
+    }
+    return *a == *b;
+}
+
+static void cmd_ps(WINDOW* wnd, char* args)
+{
+    print_all_processes(wnd);
+}
+
+static void cmd_heap(WINDOW* wnd, char* args)
+{
+    print_heap_stats(wnd);
+}
+
+static void cmd_cpu(WINDOW* wnd, char* args)
+{
+    print_cpus(wnd);
+}
+
+static void cmd_edf(WINDOW* wnd, char* args)
+{
+    print_edf(wnd);
+}
+
+static void cmd_trace(WINDOW* wnd, char* args)
+{
+    if (str_equal(args, "start")) {
+	if (trace_start())
+	    wprintf(wnd, "Tracing\n");
+	else
+	    wprintf(wnd, "Tracing needs a TRACE_SCHED kernel and a TSC\n");
+    } else if (str_equal(args, "stop"))
+	trace_stop();
+    else if (str_equal(args, "dump")) {
+	wprintf(wnd, "Sending the trace over COM2...\n");
+	trace_dump();
+	wprintf(wnd, "Done\n");
+    } else
+	wprintf(wnd, "usage: trace start|stop|dump\n");
+}
+
+static void cmd_profile(WINDOW* wnd, char* args)
+{
+    if (str_equal(args, "start")) {
+	if (profile_start())
+	    wprintf(wnd, "Profiling\n");
+	else
+	    wprintf(wnd, "Not enough memory for the profile\n");
+    } else if (str_equal(args, "stop"))
+	profile_stop();
+    else if (str_equal(args, "dump")) {
+	wprintf(wnd, "Sending the profile over COM2...\n");
+	profile_dump();
+	wprintf(wnd, "Done\n");
+    } else if (*args == '\0')
+	print_profile(wnd, 10);
+    else
+	wprintf(wnd, "usage: profile [start|stop|dump]\n");
+}
+
+static void cmd_irq(WINDOW* wnd, char* args)
+{
+    print_irq_stats(wnd);
+}
+
+static void cmd_irqoff(WINDOW* wnd, char* args)
+{
+    if (str_equal(args, "reset")) {
+	reset_intr_off_stats();
+	wprintf(wnd, "Interrupts-off statistics cleared\n");
+    } else
+	print_intr_off_stats(wnd, 10);
+}
+
+static SHELL_COMMAND shell_command[] = {
+    { "help",    cmd_help,    "list commands" },
+    { "ps",      cmd_ps,      "list processes" },
+    { "heap",    cmd_heap,    "kernel heap statistics" },
+    { "cpu",     cmd_cpu,     "load of each CPU" },
+    { "edf",     cmd_edf,     "real-time processes and deadline misses" },
+    { "irq",     cmd_irq,     "interrupt counters per IRQ line" },
+    { "irqoff",  cmd_irqoff,  "longest interrupts-off spans [reset]" },
+    { "trace",   cmd_trace,   "scheduler trace start|stop|dump (COM2)" },
+    { "profile", cmd_profile, "busiest code addresses [start|stop|dump]" },
+    { NULL,      NULL,        NULL }
+};
+
+static void cmd_help(WINDOW* wnd, char* args)
+{
+    SHELL_COMMAND* cmd;
+
+    for (cmd = shell_command; cmd->name != NULL; cmd++)
+	wprintf(wnd, "%-10s%s\n", cmd->name, cmd->help);
+}
+
+
+static char read_key()
+{
+    static PORT_REF keyb_ref = PORT_REF_INIT("keyboard");
+    Keyb_Message msg;
+    char ch;
+
+    msg.key_buffer = &ch;
+    send(lookup_port_cached(&keyb_ref), &msg);
+    return ch;
+}
+
+static void read_line(WINDOW* wnd, char* line)
+{
+    int len = 0;
+    char ch;
+
+    while ((ch = read_key()) != 13) {
+	if (ch == '\b') {
+	    if (len > 0) {
+		len--;
+		output_string(wnd, "\b \b");
+	    }
+	} else if (ch >= ' ' && len < SHELL_LINE_LEN) {
+	    line[len++] = ch;
+	    output_char(wnd, ch);
+	}
+    }
+    line[len] = '\0';
+    output_char(wnd, '\n');
+}
+
+static void run_command(WINDOW* wnd, char* line)
+{
+    SHELL_COMMAND* cmd;
+    char* args;
 
+    while (*line == ' ')
+	line++;
+    if (*line == '\0')
+	return;
+    for (args = line; *args != '\0' && *args != ' '; args++)
+	;
+    if (*args != '\0')
+	*args++ = '\0';
+    while (*args == ' ')
+	args++;
+
+    for (cmd = shell_command; cmd->name != NULL; cmd++) {
+	if (str_equal(cmd->name, line)) {
+	    cmd->func(wnd, args);
+	    return;
+	}
+    }
+    wprintf(wnd, "%s: unknown command, try help\n", line);
+}
+
+
+void shell_process(PROCESS self, PARAM param)
+{
+    char line[SHELL_LINE_LEN + 1];
+    CELL* backing;
+
+    /* without a backing store the shell still works, unmanaged */
+    backing = k_malloc(shell_wnd.width * shell_wnd.height * sizeof(CELL));
+    if (backing != NULL)
+	open_window(&shell_wnd, backing);
+    clear_window(&shell_wnd);
+    wprintf(&shell_wnd, "TOS shell, type help for a list of commands\n");
+    while (1) {
+	output_string(&shell_wnd, "> ");
+	read_line(&shell_wnd, line);
+	run_command(&shell_wnd, line);
+    }
+}
 
 
 void init_shell()
 {
+    create_process(shell_process, 5, 0, "Shell Process");
+    resign();
 }
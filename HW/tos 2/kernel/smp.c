@@ -0,0 +1,503 @@
+
+#include <kernel.h>
+
+/*
+ * Multiprocessor support
+ *
+ * Each CPU has a CPU_DEF in cpus[] holding the process it runs
+ * (active_proc) and its ready queues. The GDT has one small data
+ * segment per CPU whose base is that CPU's CPU_DEF; the CPU keeps its
+ * selector in %fs, so this_cpu() reads cpus[n].self through %fs.
+ *
+ * The boot CPU finds the other CPUs in the BIOS MP configuration table
+ * and starts them with the INIT, STARTUP, STARTUP sequence of local
+ * APIC inter-processor interrupts. Each of them gets an idle process on
+ * its own ready queue; pick_cpu() then places new processes on the
+ * least loaded CPU, and balance.c evens out the load later on. The
+ * same table tells where the I/O APIC is and how the ISA interrupts
+ * are wired to it (see apic.c).
+ *
+ * Locking
+ *
+ * The ready queues have a spinlock per CPU (see dispatch.c). Everything
+ * else a critical section used to protect by turning off interrupts on
+ * the one CPU is protected by the kernel lock: the outermost
+ * DISABLE_INTR() takes it and the matching ENABLE_INTR() drops it. The
+ * lock remembers its owner, so nested sections, and a process that
+ * blocks inside a section, work as before. resign() and the interrupt
+ * path take it before they switch processes; finish_switch() drops it
+ * again unless the resumed process was itself inside a section, in
+ * which case its ENABLE_INTR() will. As long as only one CPU runs, the
+ * kernel lock is not touched at all.
+ */
+
+#define AP_TRAMPOLINE		0x2000	/* must match startup.s */
+#define AP_STACK_SIZE		PAGE_SIZE
+
+/* saved EFLAGS in the frame of a switched-out process: edi ... eax, eip, cs */
+#define FRAME_EFLAGS		(9 * 4)
+
+/* GDT: null, code, data, data as set up by the boot loader, then the CPUs */
+#define GDT_CPU_BASE		4
+#define NUM_GDT_ENTRIES		(GDT_CPU_BASE + MAX_CPUS)
+#define CPU_SELECTOR(n)		((GDT_CPU_BASE + (n)) * 8)
+
+#define SEG_CODE		0x9A	/* present, ring 0, execute/read */
+#define SEG_DATA		0x92	/* present, ring 0, read/write */
+#define SEG_FLAT		0xC	/* 4K granularity, 32 bit */
+#define SEG_BYTES		0x4	/* byte granularity, 32 bit */
+
+/* IPI commands (ICR low word) */
+#define ICR_INIT		0x00000500
+#define ICR_STARTUP		0x00000600
+#define ICR_LEVEL_ASSERT	0x00004000
+
+/*
+ * MP configuration table (Intel MultiProcessor Specification 1.4)
+ */
+typedef struct {
+    char signature[4];		/* "_MP_" */
+    LONG config;		/* physical address of the MP_CONFIG */
+    BYTE length;		/* in 16 byte units */
+    BYTE revision;
+    BYTE checksum;
+    BYTE features[5];
+} MP_FLOATING;
+
+typedef struct {
+    char signature[4];		/* "PCMP" */
+    WORD length;
+    BYTE revision;
+    BYTE checksum;
+    char oem[8];
+    char product[12];
+    LONG oem_table;
+    WORD oem_table_size;
+    WORD num_entries;
+    LONG lapic;			/* physical address of the local APICs */
+    WORD ext_length;
+    BYTE ext_checksum;
+    BYTE reserved;
+} MP_CONFIG;
+
+#define MP_PROCESSOR		0
+#define MP_BUS			1
+#define MP_IOAPIC		2
+#define MP_IO_INTERRUPT		3
+#define MP_PROCESSOR_SIZE	20
+#define MP_OTHER_SIZE		8
+
+typedef struct {
+    BYTE type;
+    BYTE apic_id;
+    BYTE apic_version;
+    BYTE flags;
+    LONG signature;
+    LONG features;
+    LONG reserved[2];
+} MP_PROCESSOR_ENTRY;
+
+#define MP_CPU_ENABLED		1
+
+typedef struct {
+    BYTE type;
+    BYTE bus_id;
+    char bus_type[6];		/* "ISA   ", "PCI   ", ... */
+} MP_BUS_ENTRY;
+
+typedef struct {
+    BYTE type;
+    BYTE apic_id;
+    BYTE apic_version;
+    BYTE flags;
+    LONG address;		/* physical address of the registers */
+} MP_IOAPIC_ENTRY;
+
+#define MP_IOAPIC_ENABLED	1
+
+typedef struct {
+    BYTE type;
+    BYTE irq_type;
+    WORD flags;
+    BYTE src_bus;
+    BYTE src_irq;
+    BYTE dst_apic;		/* MP_ALL_IOAPICS: every I/O APIC */
+    BYTE dst_pin;
+} MP_INTERRUPT_ENTRY;
+
+#define MP_INT			0	/* vectored interrupt */
+#define MP_ALL_IOAPICS		0xFF
+#define MP_POLARITY_MASK	0x3
+#define MP_POLARITY_LOW		0x3
+#define MP_TRIGGER_MASK		0xC
+#define MP_TRIGGER_LEVEL	0xC
+
+/* bit 7 of features[1]: the interrupt mode control register exists */
+#define MP_FEATURE_IMCR		0x80
+#define IMCR_SELECT		0x22
+#define IMCR_DATA		0x23
+
+extern char ap_trampoline[], ap_gdt_ptr[], ap_stack[], ap_cpu[];
+extern char ap_trampoline_end[];
+
+static unsigned long long gdt[NUM_GDT_ENTRIES];
+
+static SPINLOCK kernel_lock = SPINLOCK_INIT;
+static volatile int kernel_lock_owner = -1;
+static BOOL smp_started = FALSE;
+static BOOL imcr_present = FALSE;
+
+static char idle_name[MAX_CPUS][12];
+
+
+void spin_lock(SPINLOCK* lock)
+{
+    while (!spin_trylock(lock))
+	while (lock->locked)
+	    asm volatile ("rep; nop");	/* pause */
+}
+
+BOOL spin_trylock(SPINLOCK* lock)
+{
+    int old = 1;
+
+    asm volatile ("xchgl %0,%1"
+		  : "+r" (old), "+m" (lock->locked) : : "memory");
+    return old == 0;
+}
+
+void spin_unlock(SPINLOCK* lock)
+{
+    /* x86 does not reorder stores, so a compiler barrier is enough */
+    asm volatile ("" : : : "memory");
+    lock->locked = 0;
+}
+
+
+/*
+ * Called by the outermost DISABLE_INTR(), with interrupts off
+ */
+void kernel_lock_enter()
+{
+    int id;
+
+    if (!smp_started)
+	return;
+    id = this_cpu()->id;
+    if (kernel_lock_owner == id)
+	return;
+    spin_lock(&kernel_lock);
+    kernel_lock_owner = id;
+}
+
+/*
+ * Called by the outermost ENABLE_INTR(), with interrupts still off
+ */
+void kernel_lock_leave()
+{
+    if (kernel_lock_owner != this_cpu()->id)
+	return;
+    kernel_lock_owner = -1;
+    spin_unlock(&kernel_lock);
+}
+
+
+/*
+ * Called on the stack of the process being resumed, just before its
+ * registers are popped. Hands the FPU over lazily and drops the kernel
+ * lock unless the process goes back into a critical section, i.e.
+ * resumes with interrupts off.
+ */
+void finish_switch()
+{
+    fpu_switch(active_proc);
+    if (peek_l(active_proc->esp + FRAME_EFLAGS) & EFLAGS_IF)
+	kernel_lock_leave();
+}
+
+
+static unsigned long long segment(MEM_ADDR base, unsigned limit,
+				  unsigned type, unsigned flags)
+{
+    return (limit & 0xFFFF) |
+	   ((unsigned long long) (base & 0xFFFFFF) << 16) |
+	   ((unsigned long long) type << 40) |
+	   ((unsigned long long) ((limit >> 16) & 0xF) << 48) |
+	   ((unsigned long long) flags << 52) |
+	   ((unsigned long long) (base >> 24) << 56);
+}
+
+static void load_gdt()
+{
+    volatile unsigned char   mem48 [6];
+    volatile unsigned       *base_ptr;
+    volatile short unsigned *limit_ptr;
+
+    base_ptr   = (unsigned *) &mem48[2];
+    limit_ptr  = (short unsigned *) &mem48[0];
+    *base_ptr  = (unsigned) gdt;
+    *limit_ptr = sizeof(gdt) - 1;
+    asm volatile ("lgdt %0" : : "m" (mem48));
+    asm volatile ("ljmp %0,$1f\n1:" : : "i" (CODE_SELECTOR));
+    asm volatile ("movw %w0,%%ds; movw %w0,%%es; movw %w0,%%gs; movw %w0,%%ss"
+		  : : "r" (DATA_SELECTOR));
+}
+
+static void load_cpu_segment(int id)
+{
+    asm volatile ("movw %w0,%%fs" : : "r" (CPU_SELECTOR(id)) : "memory");
+}
+
+
+/*
+ * Sets up the GDT with the per-CPU segments and makes this CPU cpus[0].
+ * Called from startup.s before kernel_main(), since everything that
+ * uses active_proc depends on it.
+ */
+void init_cpus()
+{
+    int i;
+
+    k_memset(cpus, 0, MAX_CPUS * sizeof(CPU_DEF));
+    gdt[0] = 0;
+    gdt[1] = segment(0, 0xFFFFF, SEG_CODE, SEG_FLAT);
+    gdt[2] = segment(0, 0xFFFFF, SEG_DATA, SEG_FLAT);
+    gdt[3] = segment(0, 0xFFFFF, SEG_DATA, SEG_FLAT);
+    for (i = 0; i < MAX_CPUS; i++) {
+	cpus[i].self = &cpus[i];
+	cpus[i].id = i;
+	gdt[GDT_CPU_BASE + i] = segment((MEM_ADDR) &cpus[i],
+					sizeof(CPU_DEF) - 1,
+					SEG_DATA, SEG_BYTES);
+    }
+    load_gdt();
+    load_cpu_segment(0);
+    cpus[0].online = TRUE;
+}
+
+
+static BOOL checksum_ok(MEM_ADDR addr, int len)
+{
+    BYTE sum = 0;
+
+    while (len--)
+	sum += peek_b(addr++);
+    return sum == 0;
+}
+
+/*
+ * Looks for the MP floating pointer in the BIOS ROM. The specification
+ * also allows the first KB of the EBDA and the last KB of base memory,
+ * but those are below 640K, where the process stacks have long since
+ * overwritten them.
+ */
+static MP_CONFIG* find_mp_config()
+{
+    MP_FLOATING* mp;
+    MP_CONFIG* config;
+    MEM_ADDR addr;
+
+    for (addr = 0xF0000; addr < 0x100000; addr += 16) {
+	mp = (MP_FLOATING*) addr;
+	if (k_memcmp(mp->signature, "_MP_", 4) == 0 &&
+	    checksum_ok(addr, mp->length * 16))
+	    break;
+    }
+    if (addr == 0x100000 || mp->config == 0)
+	/* none, or one of the default configurations without a table */
+	return NULL;
+    if (mp->config >= 0x100000 && mp->config >= get_memory_top())
+	/* not covered by the kernel's identity map */
+	return NULL;
+    config = (MP_CONFIG*) mp->config;
+    if (k_memcmp(config->signature, "PCMP", 4) != 0 ||
+	!checksum_ok(mp->config, config->length))
+	return NULL;
+    imcr_present = (mp->features[1] & MP_FEATURE_IMCR) != 0;
+    return config;
+}
+
+/* fills in cpus[] from the processor entries of the MP table */
+static void find_cpus(MP_CONFIG* config)
+{
+    MP_PROCESSOR_ENTRY* cpu;
+    BYTE* entry = (BYTE*) (config + 1);
+    int i;
+
+    for (i = 0; i < config->num_entries; i++) {
+	if (*entry != MP_PROCESSOR) {
+	    entry += MP_OTHER_SIZE;
+	    continue;
+	}
+	cpu = (MP_PROCESSOR_ENTRY*) entry;
+	entry += MP_PROCESSOR_SIZE;
+	if (!(cpu->flags & MP_CPU_ENABLED) || cpu->apic_id == cpus[0].apic_id)
+	    continue;
+	if (num_cpus == MAX_CPUS)
+	    break;
+	cpus[num_cpus++].apic_id = cpu->apic_id;
+    }
+}
+
+/*
+ * Returns the physical address of the first I/O APIC in the MP table,
+ * or 0, and tells apic.c which of its pins the ISA interrupts use. Only
+ * that I/O APIC is used; the ISA interrupts are always on the first.
+ */
+static MEM_ADDR find_ioapic(MP_CONFIG* config)
+{
+    MP_BUS_ENTRY* bus;
+    MP_IOAPIC_ENTRY* ioapic = NULL;
+    MP_INTERRUPT_ENTRY* intr;
+    unsigned isa_buses = 0;
+    BYTE* entry = (BYTE*) (config + 1);
+    int i;
+
+    /* the entries are sorted by type: buses and I/O APICs come first */
+    for (i = 0; i < config->num_entries; i++) {
+	switch (*entry) {
+	case MP_PROCESSOR:
+	    entry += MP_PROCESSOR_SIZE;
+	    continue;
+	case MP_BUS:
+	    bus = (MP_BUS_ENTRY*) entry;
+	    if (k_memcmp(bus->bus_type, "ISA", 3) == 0 && bus->bus_id < 32)
+		isa_buses |= 1 << bus->bus_id;
+	    break;
+	case MP_IOAPIC:
+	    if (ioapic == NULL &&
+		(((MP_IOAPIC_ENTRY*) entry)->flags & MP_IOAPIC_ENABLED))
+		ioapic = (MP_IOAPIC_ENTRY*) entry;
+	    break;
+	case MP_IO_INTERRUPT:
+	    intr = (MP_INTERRUPT_ENTRY*) entry;
+	    if (ioapic != NULL && intr->irq_type == MP_INT &&
+		intr->src_bus < 32 && (isa_buses & (1 << intr->src_bus)) &&
+		intr->src_irq < NUM_IRQS &&
+		(intr->dst_apic == ioapic->apic_id ||
+		 intr->dst_apic == MP_ALL_IOAPICS))
+		set_isa_irq_pin(intr->src_irq, intr->dst_pin,
+				(intr->flags & MP_POLARITY_MASK) == MP_POLARITY_LOW,
+				(intr->flags & MP_TRIGGER_MASK) == MP_TRIGGER_LEVEL);
+	    break;
+	}
+	entry += MP_OTHER_SIZE;
+    }
+    return ioapic != NULL ? ioapic->address : 0;
+}
+
+
+static void idle_process(PROCESS self, PARAM param)
+{
+    while (1) {
+	/* the lists are peeked at without the lock; resign() rechecks */
+	if (ready_lists_state != 1 || self->next != self ||
+	    this_cpu()->edf_queue != NULL || steal_work())
+	    resign();
+    }
+}
+
+/*
+ * First C code of an application processor, on its boot stack
+ */
+void ap_main(int id)
+{
+    load_cpu_segment(id);
+    init_paging_ap();
+    load_idt(idt);
+    init_fpu();
+    enable_lapic();
+    start_lapic_timer();
+
+    kernel_lock_enter();
+    this_cpu()->online = TRUE;
+    active_proc = this_cpu()->idle;
+    switch_address_space(active_proc);
+    asm ("movl %0,%%esp" : : "r" (active_proc->esp));
+    finish_switch();
+
+    asm("popl %edi");
+    asm("popl %esi");
+    asm("popl %ebp");
+    asm("popl %ebx");
+    asm("popl %edx");
+    asm("popl %ecx");
+    asm("popl %eax");
+    asm("iret");
+}
+
+/* creates the idle process of cpus[id] and starts that CPU */
+static void start_cpu(int id)
+{
+    CPU_DEF* cpu = &cpus[id];
+    PROCESS idle;
+    char* stack;
+    int i;
+
+    stack = k_malloc(AP_STACK_SIZE);
+    if (stack == NULL)
+	return;
+    k_memcpy(idle_name[id], "Idle CPU 0", 11);
+    idle_name[id][9] += id;
+    idle = create_process(idle_process, 0, 0, idle_name[id])->owner;
+    remove_ready_queue(idle);
+    idle->cpu = id;
+    idle->affinity = CPU_MASK(id);
+    add_ready_queue(idle);
+    cpu->idle = idle;
+
+    poke_l(AP_TRAMPOLINE + (ap_stack - ap_trampoline),
+	   (MEM_ADDR) stack + AP_STACK_SIZE);
+    poke_l(AP_TRAMPOLINE + (ap_cpu - ap_trampoline), id);
+
+    lapic_send_ipi(cpu->apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+    udelay(10000);
+    for (i = 0; i < 2 && !cpu->online; i++) {
+	lapic_send_ipi(cpu->apic_id,
+		       ICR_STARTUP | ICR_LEVEL_ASSERT | (AP_TRAMPOLINE >> 12));
+	udelay(200);
+    }
+    for (i = 0; i < 100 && !cpu->online; i++)
+	udelay(1000);
+    if (!cpu->online)
+	kprintf("CPU %d (APIC %d) did not start\n", id, cpu->apic_id);
+}
+
+
+/*
+ * Switches the interrupts over to the APICs and starts the other CPUs,
+ * if there are any. Called by the boot process once interrupts and the
+ * idle process of the boot CPU are set up.
+ */
+void init_smp()
+{
+    MP_CONFIG* config;
+    MEM_ADDR ioapic;
+    int i;
+
+    config = find_mp_config();
+    if (config == NULL || !init_lapic(config->lapic))
+	return;
+    cpus[0].apic_id = lapic_id();
+    find_cpus(config);
+    if ((ioapic = find_ioapic(config)) != 0) {
+	init_ioapic(ioapic);
+	if (imcr_present) {
+	    /* disconnect the 8259s from the CPU's interrupt pin */
+	    outportb(IMCR_SELECT, 0x70);
+	    outportb(IMCR_DATA, 0x01);
+	}
+    }
+    start_lapic_timer();
+    if (num_cpus == 1)
+	return;
+
+    k_memcpy((void*) AP_TRAMPOLINE, ap_trampoline,
+	     ap_trampoline_end - ap_trampoline);
+    poke_w(AP_TRAMPOLINE + (ap_gdt_ptr - ap_trampoline), sizeof(gdt) - 1);
+    poke_l(AP_TRAMPOLINE + (ap_gdt_ptr - ap_trampoline) + 2, (MEM_ADDR) gdt);
+
+    smp_started = TRUE;
+    for (i = 1; i < num_cpus; i++)
+	start_cpu(i);
+}
@@ -13,6 +13,65 @@ start:
 	movw %ax,%gs
 	movw %ax,%ss
 	movl $640 * 1024, %esp
+	call init_cpus		# per-CPU segment in %fs, used by active_proc
+	pushl %ebx		# memory map from the boot loader
 	call kernel_main
 L1:
 	jmp L1
+
+
+/*
+ * Application processor startup code. init_smp() copies it to
+ * AP_TRAMPOLINE (a page below 1MB, as the start-up IPI requires) and
+ * fills in the fields at its end. An AP starts executing it in real
+ * mode at AP_TRAMPOLINE:0, loads the kernel GDT, switches to protected
+ * mode and calls ap_main(cpu) on its boot stack. Addresses are relative
+ * to AP_TRAMPOLINE since the code does not run where it was linked.
+ */
+
+	.set AP_TRAMPOLINE, 0x2000	# must match AP_TRAMPOLINE in smp.c
+
+.globl ap_trampoline
+.globl ap_gdt_ptr
+.globl ap_stack
+.globl ap_cpu
+.globl ap_trampoline_end
+
+	.align 16
+	.code16
+ap_trampoline:
+	cli
+	cld
+	xorw %ax,%ax
+	movw %ax,%ds
+	lgdtl AP_TRAMPOLINE + (ap_gdt_ptr - ap_trampoline)
+	movl %cr0,%eax
+	orl $1,%eax		# PE
+	movl %eax,%cr0
+	ljmpl $0x08,$AP_TRAMPOLINE + (ap_protected - ap_trampoline)
+
+	.code32
+ap_protected:
+	movw $0x10,%ax
+	movw %ax,%ds
+	movw %ax,%es
+	movw %ax,%gs
+	movw %ax,%ss
+	movl AP_TRAMPOLINE + (ap_stack - ap_trampoline),%esp
+	pushl AP_TRAMPOLINE + (ap_cpu - ap_trampoline)
+	movl $ap_main,%eax	# absolute, unlike the addresses above
+	call *%eax
+L2:
+	hlt
+	jmp L2
+
+	.align 4
+ap_gdt_ptr:
+	.word 0			# limit
+	.long 0			# base
+	.align 4
+ap_stack:
+	.long 0
+ap_cpu:
+	.long 0
+ap_trampoline_end:
@@ -1,4 +1,36 @@
 
+#include <kernel.h>
+
+
+/*
+ * Copies shorter than this are done byte by byte, since aligning the
+ * pointers would cost more than it saves.
+ */
+#define SMALL_LEN	16
+
+/*
+ * Minimum length for the SSE2 path of k_memcpy()/k_memset()
+ */
+#define SSE2_MIN_LEN	256
+
+
+/*
+ * The kernel is compiled for the i386, where gcc neither uses nor
+ * accepts the XMM registers in clobber lists. A host build may use them.
+ */
+#ifdef __SSE__
+#define XMM0_CLOBBER	, "xmm0"
+#define XMM_CLOBBERS	, "xmm0", "xmm1", "xmm2", "xmm3"
+#else
+#define XMM0_CLOBBER
+#define XMM_CLOBBERS
+#endif
+
+
+/* TRUE if k_memcpy()/k_memset() may use the SSE2 instructions */
+static BOOL use_sse2 = FALSE;
+
+
 /* 
  * Computes the length of the string str up to 
  * but not including the terminating null character.
@@ -13,26 +45,133 @@ int k_strlen(const char * str) {
 /*
  * Copies n characters from memory area str2 to memory area str1
  * This function returns a pointer to destination, which is str1.
+ * The destination is first aligned to a dword boundary so that the
+ * bulk of the data is moved with rep movsl (or 64 bytes at a time
+ * with SSE2 if enabled); the remaining tail is copied bytewise.
  * TODO: check memory error
  */
 void *k_memcpy(void *str1, const void *str2, int n) {
  	char *des = (char*) str1;
- 	char *src = (char*) str2;
-	while(n--) {
+ 	const char *src = (const char*) str2;
+	unsigned long count;
+
+	if (n >= SMALL_LEN) {
+		count = (-(unsigned long) des) & 3;
+		n -= count;
+		while (count--)
+			*des++ = *src++;
+
+		if (use_sse2 && n >= SSE2_MIN_LEN) {
+			count = (-(unsigned long) des) & 15;
+			n -= count;
+			while (count--)
+				*des++ = *src++;
+			count = n >> 6;
+			n &= 63;
+			asm volatile ("1:\n\t"
+				      "movdqu   (%1),%%xmm0\n\t"
+				      "movdqu 16(%1),%%xmm1\n\t"
+				      "movdqu 32(%1),%%xmm2\n\t"
+				      "movdqu 48(%1),%%xmm3\n\t"
+				      "movdqa %%xmm0,  (%0)\n\t"
+				      "movdqa %%xmm1,16(%0)\n\t"
+				      "movdqa %%xmm2,32(%0)\n\t"
+				      "movdqa %%xmm3,48(%0)\n\t"
+				      "add $64,%0\n\t"
+				      "add $64,%1\n\t"
+				      "dec %2\n\t"
+				      "jnz 1b"
+				      : "+r" (des), "+r" (src), "+r" (count)
+				      :
+				      : "memory", "cc" XMM_CLOBBERS);
+		}
+
+		count = n >> 2;
+		n &= 3;
+		asm volatile ("rep movsl"
+			      : "+D" (des), "+S" (src), "+c" (count)
+			      :
+			      : "memory");
+	}
+	while(n-- > 0) {
  		*des++ = *src++;
  	}
  	return str1;
 }
 
+/*
+ * Fills the first n bytes of the memory area pointed to by str with
+ * the constant byte c. Returns str.
+ */
+void *k_memset(void *str, int c, int n) {
+	char *des = (char*) str;
+	LONG pattern = (BYTE) c * 0x01010101;
+	unsigned long count;
+
+	if (n >= SMALL_LEN) {
+		count = (-(unsigned long) des) & 3;
+		n -= count;
+		while (count--)
+			*des++ = c;
+
+		if (use_sse2 && n >= SSE2_MIN_LEN) {
+			count = (-(unsigned long) des) & 15;
+			n -= count;
+			while (count--)
+				*des++ = c;
+			count = n >> 6;
+			n &= 63;
+			asm volatile ("movd %3,%%xmm0\n\t"
+				      "pshufd $0,%%xmm0,%%xmm0\n\t"
+				      "1:\n\t"
+				      "movdqa %%xmm0,  (%0)\n\t"
+				      "movdqa %%xmm0,16(%0)\n\t"
+				      "movdqa %%xmm0,32(%0)\n\t"
+				      "movdqa %%xmm0,48(%0)\n\t"
+				      "add $64,%0\n\t"
+				      "dec %1\n\t"
+				      "jnz 1b"
+				      : "=r" (des), "=r" (count)
+				      : "0" (des), "r" (pattern), "1" (count)
+				      : "memory", "cc" XMM0_CLOBBER);
+		}
+
+		count = n >> 2;
+		n &= 3;
+		asm volatile ("rep stosl"
+			      : "+D" (des), "+c" (count)
+			      : "a" (pattern)
+			      : "memory");
+	}
+	while (n-- > 0)
+		*des++ = c;
+	return str;
+}
+
 /* Compares the first num bytes of the block of memory pointed by ptr1 
  * to the first num bytes pointed by ptr2, returning zero if they all match 
  * or a value different from zero representing which is greater if they do not.
  * Notice that, unlike strcmp, the function does not stop comparing after 
  * finding a null character.
+ * Equal prefixes are skipped a dword at a time; the first differing
+ * dword is then resolved bytewise.
  */
 int k_memcmp(const void * ptr1, const void * ptr2, int n) {
 	unsigned char *des = (unsigned char*) ptr1;
  	unsigned char *src = (unsigned char*) ptr2;
+
+	if (n >= SMALL_LEN) {
+		while (((unsigned long) des & 3) != 0) {
+			int d = *des++ - *src++;
+			if (d) return d;
+			n--;
+		}
+		while (n >= 4 && *(LONG*) des == *(LONG*) src) {
+			des += 4;
+			src += 4;
+			n -= 4;
+		}
+	}
 	while(n > 0) {
 		int d = *des++ - *src++;
 		if (d) return d;
@@ -40,3 +179,15 @@ int k_memcmp(const void * ptr1, const void * ptr2, int n) {
 	}
 	return 0;
 }
+
+
+BOOL k_mem_enable_sse2()
+{
+	use_sse2 = (cpu_features() & CPU_FEATURE_SSE2) != 0;
+	return use_sse2;
+}
+
+void k_mem_disable_sse2()
+{
+	use_sse2 = FALSE;
+}
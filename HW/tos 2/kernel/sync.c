@@ -0,0 +1,244 @@
+
+#include <kernel.h>
+
+/*
+ * Semaphores, mutexes and condition variables
+ *
+ * The count of a semaphore is updated with an atomic add, so a wait
+ * on a positive count or a signal without waiters never disables
+ * interrupts and never enters the dispatcher. A negative count is the
+ * number of processes that have committed to wait. Only those go the
+ * slow path, which runs with interrupts disabled and queues the process
+ * on the semaphore's wait list through its next_blocked link.
+ *
+ * A waiter may be preempted after it has decremented the count but
+ * before it has queued itself. A signal arriving in that window finds
+ * the wait list empty and leaves a pending wakeup, which the waiter
+ * consumes instead of blocking.
+ *
+ * A mutex is a binary semaphore that remembers its owner. A condition
+ * variable is a plain wait list. cond_wait() queues the caller and
+ * releases the mutex with interrupts disabled, so a signal sent after
+ * the mutex is released cannot be missed.
+ */
+
+
+/* atomically adds delta to *p and returns the old value */
+static inline int atomic_add(volatile int* p, int delta)
+{
+    asm volatile ("lock; xaddl %0,%1"
+		  : "+r" (delta), "+m" (*p) : : "memory");
+    return delta;
+}
+
+/* sets *p to new if it equals old; returns TRUE if it did */
+static inline BOOL atomic_cmpxchg(volatile int* p, int old, int new)
+{
+    int prev;
+
+    asm volatile ("lock; cmpxchgl %2,%1"
+		  : "=a" (prev), "+m" (*p) : "r" (new), "0" (old) : "memory");
+    return prev == old;
+}
+
+static void enqueue_waiter(PROCESS* head, PROCESS* tail, PROCESS proc)
+{
+    proc->next_blocked = NULL;
+    if (*head == NULL)
+	*head = proc;
+    else
+	(*tail)->next_blocked = proc;
+    *tail = proc;
+}
+
+static PROCESS dequeue_waiter(PROCESS* head, PROCESS* tail)
+{
+    PROCESS proc = *head;
+
+    if (proc != NULL) {
+	*head = proc->next_blocked;
+	if (*head == NULL)
+	    *tail = NULL;
+	proc->next_blocked = NULL;
+    }
+    return proc;
+}
+
+/* must be called with interrupts disabled */
+static void block_sync()
+{
+    active_proc->state = STATE_SYNC_BLOCKED;
+    remove_ready_queue(active_proc);
+    resign();
+}
+
+
+void init_semaphore(SEMAPHORE* sem, int count)
+{
+    assert(count >= 0);
+    sem->magic = MAGIC_SEMAPHORE;
+    sem->count = count;
+    sem->wakeups = 0;
+    sem->wait_head = NULL;
+    sem->wait_tail = NULL;
+}
+
+
+/*
+ * Decrements the count of the semaphore, blocking while it is zero.
+ */
+void sem_wait(SEMAPHORE* sem)
+{
+    volatile int saved_if;
+
+    assert(sem->magic == MAGIC_SEMAPHORE);
+    if (atomic_add(&sem->count, -1) > 0)
+	return;
+
+    DISABLE_INTR(saved_if);
+    if (sem->wakeups > 0)
+	sem->wakeups--;
+    else {
+	enqueue_waiter(&sem->wait_head, &sem->wait_tail, active_proc);
+	block_sync();
+    }
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Decrements the count of the semaphore if it is positive. Returns
+ * FALSE instead of blocking if it is zero.
+ */
+BOOL sem_try_wait(SEMAPHORE* sem)
+{
+    int count;
+
+    assert(sem->magic == MAGIC_SEMAPHORE);
+    do {
+	count = sem->count;
+	if (count <= 0)
+	    return FALSE;
+    } while (!atomic_cmpxchg(&sem->count, count, count - 1));
+    return TRUE;
+}
+
+
+/*
+ * Increments the count of the semaphore and wakes up one waiter.
+ */
+void sem_signal(SEMAPHORE* sem)
+{
+    PROCESS proc;
+    volatile int saved_if;
+
+    assert(sem->magic == MAGIC_SEMAPHORE);
+    if (atomic_add(&sem->count, 1) >= 0)
+	return;
+
+    DISABLE_INTR(saved_if);
+    proc = dequeue_waiter(&sem->wait_head, &sem->wait_tail);
+    if (proc != NULL)
+	add_ready_queue(proc);
+    else
+	/* the waiter has not queued itself yet */
+	sem->wakeups++;
+    ENABLE_INTR(saved_if);
+}
+
+
+void init_mutex(MUTEX* mutex)
+{
+    init_semaphore(&mutex->sem, 1);
+    mutex->owner = NULL;
+}
+
+
+void mutex_lock(MUTEX* mutex)
+{
+    assert(mutex->owner != active_proc);
+    sem_wait(&mutex->sem);
+    mutex->owner = active_proc;
+}
+
+
+BOOL mutex_try_lock(MUTEX* mutex)
+{
+    if (!sem_try_wait(&mutex->sem))
+	return FALSE;
+    mutex->owner = active_proc;
+    return TRUE;
+}
+
+
+void mutex_unlock(MUTEX* mutex)
+{
+    assert(mutex->owner == active_proc);
+    mutex->owner = NULL;
+    sem_signal(&mutex->sem);
+}
+
+
+void init_condvar(CONDVAR* cv)
+{
+    cv->magic = MAGIC_CONDVAR;
+    cv->wait_head = NULL;
+    cv->wait_tail = NULL;
+}
+
+
+/*
+ * Releases mutex, waits until cv is signalled and locks mutex again.
+ * The caller must hold mutex.
+ */
+void cond_wait(CONDVAR* cv, MUTEX* mutex)
+{
+    volatile int saved_if;
+
+    assert(cv->magic == MAGIC_CONDVAR);
+    DISABLE_INTR(saved_if);
+    enqueue_waiter(&cv->wait_head, &cv->wait_tail, active_proc);
+    mutex_unlock(mutex);
+    block_sync();
+    ENABLE_INTR(saved_if);
+    mutex_lock(mutex);
+}
+
+
+/*
+ * Wakes up one process waiting on cv. When called with the mutex held,
+ * as it should be, the check for waiters needs no lock because waiters
+ * only queue themselves while holding the mutex.
+ */
+void cond_signal(CONDVAR* cv)
+{
+    PROCESS proc;
+    volatile int saved_if;
+
+    assert(cv->magic == MAGIC_CONDVAR);
+    if (cv->wait_head == NULL)
+	return;
+    DISABLE_INTR(saved_if);
+    proc = dequeue_waiter(&cv->wait_head, &cv->wait_tail);
+    if (proc != NULL)
+	add_ready_queue(proc);
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Wakes up every process waiting on cv.
+ */
+void cond_broadcast(CONDVAR* cv)
+{
+    PROCESS proc;
+    volatile int saved_if;
+
+    assert(cv->magic == MAGIC_CONDVAR);
+    if (cv->wait_head == NULL)
+	return;
+    DISABLE_INTR(saved_if);
+    while ((proc = dequeue_waiter(&cv->wait_head, &cv->wait_tail)) != NULL)
+	add_ready_queue(proc);
+    ENABLE_INTR(saved_if);
+}
@@ -0,0 +1,72 @@
+
+#include <kernel.h>
+
+/*
+ * Tasklets
+ *
+ * A tasklet is a small piece of deferred interrupt work. An ISR (or a
+ * process) schedules it, and it runs on the way out of the next
+ * interrupt, after the interrupt has been acknowledged and before the
+ * dispatcher picks the process to resume. This lets a device hand an
+ * event to its server, for example with post_event(), without a
+ * notifier process and the two context switches that come with it.
+ *
+ * Tasklets run with interrupts disabled and in the context of whatever
+ * process was interrupted, so they must be short and must not block.
+ * A tasklet that is scheduled again before it has run runs only once.
+ */
+
+static TASKLET* tasklet_head;
+static TASKLET* tasklet_tail;
+
+
+void init_tasklet(TASKLET* t, void (*func) (void* data), void* data)
+{
+    t->func = func;
+    t->data = data;
+    t->scheduled = FALSE;
+    t->next = NULL;
+}
+
+
+void schedule_tasklet(TASKLET* t)
+{
+    volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    if (!t->scheduled) {
+	t->scheduled = TRUE;
+	t->next = NULL;
+	if (tasklet_head == NULL)
+	    tasklet_head = t;
+	else
+	    tasklet_tail->next = t;
+	tasklet_tail = t;
+    }
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * Runs all scheduled tasklets, including any they schedule themselves.
+ * Called from irq_dispatch() with interrupts disabled.
+ */
+void run_tasklets()
+{
+    TASKLET* t;
+
+    while ((t = tasklet_head) != NULL) {
+	tasklet_head = t->next;
+	if (tasklet_head == NULL)
+	    tasklet_tail = NULL;
+	t->scheduled = FALSE;
+	t->func(t->data);
+    }
+}
+
+
+void init_tasklets()
+{
+    tasklet_head = NULL;
+    tasklet_tail = NULL;
+}
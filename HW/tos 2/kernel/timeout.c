@@ -0,0 +1,144 @@
+
+#include <kernel.h>
+
+/*
+ * Timeouts for blocking calls
+ *
+ * A process that blocks with a timeout is put on timeout_list, which
+ * is sorted by deadline. The timer ISR calls timer_tick(), which
+ * unblocks every process whose deadline has passed: it is taken off
+ * whatever it was waiting on, marked timed_out and put back on the
+ * ready queue. Processes that are woken up normally remove themselves
+ * from the list with cancel_timeout(). Until they get to run they stay
+ * on it, so timer_tick() only drops a process that is no longer blocked.
+ */
+
+volatile unsigned timer_ticks;
+
+static PROCESS timeout_list;
+
+
+/* TRUE if tick a comes before tick b, allowing for wraparound */
+static BOOL tick_before(unsigned a, unsigned b)
+{
+    return (int) (a - b) < 0;
+}
+
+
+/*
+ * Arms a timeout of ticks timer ticks for proc. Must be called with
+ * interrupts disabled, before proc blocks.
+ */
+void add_timeout(PROCESS proc, unsigned ticks)
+{
+    PROCESS* p;
+
+    proc->timed_out = FALSE;
+    proc->timeout_tick = timer_ticks + ticks;
+    for (p = &timeout_list; *p != NULL; p = &(*p)->next_timeout)
+	if (tick_before(proc->timeout_tick, (*p)->timeout_tick))
+	    break;
+    proc->next_timeout = *p;
+    *p = proc;
+}
+
+
+/*
+ * Disarms the timeout of proc, if it is still on the list. Must be
+ * called with interrupts disabled.
+ */
+void cancel_timeout(PROCESS proc)
+{
+    PROCESS* p;
+
+    for (p = &timeout_list; *p != NULL; p = &(*p)->next_timeout) {
+	if (*p == proc) {
+	    *p = proc->next_timeout;
+	    break;
+	}
+    }
+    proc->next_timeout = NULL;
+}
+
+
+/*
+ * TRUE if proc is still in a wait that a timeout may end. Semaphores
+ * and mutexes take no timeout, so SYNC_BLOCKED is not one of them.
+ */
+static BOOL is_waiting(PROCESS proc)
+{
+    switch (proc->state) {
+    case STATE_SEND_BLOCKED:
+    case STATE_REPLY_BLOCKED:
+    case STATE_RECEIVE_BLOCKED:
+    case STATE_INTR_BLOCKED:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+/* take proc off the object it is blocked on */
+static void abort_wait(PROCESS proc)
+{
+    PROCESS* p;
+
+    switch (proc->state) {
+    case STATE_SEND_BLOCKED:
+	for (p = &proc->blocked_port->blocked_list_head; *p != NULL;
+	     p = &(*p)->next_blocked) {
+	    if (*p == proc) {
+		*p = proc->next_blocked;
+		break;
+	    }
+	}
+	/* recompute the tail */
+	proc->blocked_port->blocked_list_tail = NULL;
+	for (p = &proc->blocked_port->blocked_list_head; *p != NULL;
+	     p = &(*p)->next_blocked)
+	    proc->blocked_port->blocked_list_tail = *p;
+	break;
+
+    case STATE_INTR_BLOCKED:
+	remove_intr_waiter(proc);
+	break;
+
+    case STATE_REPLY_BLOCKED:
+	/* the receiver may still reply(); it is ignored from now on */
+	proc->reply_from = NULL;
+	break;
+
+    default:
+	/* receive blocked processes are on no list */
+	break;
+    }
+}
+
+
+/*
+ * Called from the timer ISR on every tick
+ */
+void timer_tick()
+{
+    PROCESS proc;
+
+    timer_ticks++;
+    while (timeout_list != NULL &&
+	   !tick_before(timer_ticks, timeout_list->timeout_tick)) {
+	proc = timeout_list;
+	timeout_list = proc->next_timeout;
+	proc->next_timeout = NULL;
+	/* woken up in the meantime, but has not run cancel_timeout() yet */
+	if (!is_waiting(proc))
+	    continue;
+	abort_wait(proc);
+	proc->timed_out = TRUE;
+	add_ready_queue(proc);
+    }
+}
+
+
+void init_timeouts()
+{
+    timeout_list = NULL;
+}
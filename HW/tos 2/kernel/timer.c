@@ -4,58 +4,141 @@
 
 PORT timer_port;
 
-/* helper process which waits for interrupt */
-void timer_notifier(PROCESS self, PARAM param)
+static TASKLET timer_tasklet;
+
+/* runs after every timer interrupt and passes the tick on to the timer process */
+static void timer_bottom_half(void* data)
 {
-	while (1) {
-		wait_for_interrupt(TIMER_IRQ);
-		message(timer_port, 0);
-	}
+	post_event(timer_port);
 }
 
+/* TRUE if tick has been reached, allowing for wraparound */
+static BOOL tick_reached(unsigned tick)
+{
+	return (int) (timer_ticks - tick) >= 0;
+}
+
+/*
+ * The timer process keeps the tick at which each sleeping process is
+ * to wake up. Sleeps are absolute, so a process that asks to wake up
+ * at a given tick wakes up at that tick no matter how long it took to
+ * ask, and a tick that has already passed wakes it up at once.
+ * timer_ticks is read rather than the ticks counted, since ticks that
+ * arrive while the timer process is busy are coalesced.
+ */
 void timer_process(PROCESS self, PARAM param)
 {
-	int i, process_number;
+	int i;
 	Timer_Message *message;	
-	int sleep_table[MAX_PROCS];
+	unsigned wake_tick[MAX_PROCS];
+	BOOL sleeping[MAX_PROCS];
 	PROCESS sender;
 
-	// init sleep_table
 	for (i = 0; i < MAX_PROCS; i++) {
-		sleep_table[i] = 0;
+		sleeping[i] = FALSE;
 	}
 
-	create_process(timer_notifier, 7, 0, "timer notifier");
-
 	while (1) {
 		message = (Timer_Message*) receive(&sender);
-		if (message != NULL) { // from user process
-			process_number = sender - pcb;
-			assert(&pcb[process_number] == sender);
-			sleep_table[process_number] = message->num_of_ticks; // record the sleep time
-		} else { // from timer notifier
-			for (i = 0; i < MAX_PROCS; i++) {
-				if (sleep_table[i]) { // only decrement non-zero
-					sleep_table[i]--;
-					if (sleep_table[i]) { // time is up
-						reply(&pcb[i]);
-					}
-				}
+		if (sender != NULL) { // from user process
+			i = sender - pcb;
+			assert(&pcb[i] == sender);
+			if (message->num_of_ticks == TIMER_UNTIL)
+				wake_tick[i] = message->wake_tick;
+			else
+				wake_tick[i] = timer_ticks + message->num_of_ticks;
+			sleeping[i] = TRUE;
+		}
+		// a new sleep may already be due, so check on every message
+		for (i = 0; i < MAX_PROCS; i++) {
+			if (sleeping[i] && tick_reached(wake_tick[i])) {
+				sleeping[i] = FALSE;
+				reply(&pcb[i]);
 			}
 		}
 	}
 }
 
+static void timer_request(Timer_Message* message)
+{
+	static PORT_REF timer_ref = PORT_REF_INIT("timer");
+	send(lookup_port_cached(&timer_ref), message);
+}
+
+/*
+ * Blocks the calling process for ticks timer ticks. A negative count
+ * is taken as 0, so that it cannot be mistaken for TIMER_UNTIL.
+ */
 void sleep(int ticks)
 {
 	Timer_Message message;
-	message.num_of_ticks = ticks;
-	send(timer_port, &message);
+	message.num_of_ticks = (ticks < 0) ? 0 : ticks;
+	timer_request(&message);
+}
+
+/*
+ * Blocks the calling process until timer_ticks reaches tick. Returns
+ * at once if it already has.
+ */
+void sleep_until(unsigned tick)
+{
+	Timer_Message message;
+	message.num_of_ticks = TIMER_UNTIL;
+	message.wake_tick = tick;
+	timer_request(&message);
+}
+
+
+/*
+ * Periodic timers
+ *
+ * A loop that sleeps for its period after doing its work runs a little
+ * slower than intended, by however long the work took. A periodic
+ * timer instead computes each expiry from the previous one, so the
+ * loop keeps its rate:
+ *
+ *	init_periodic_timer(&t, period);
+ *	while (1) {
+ *		wait_periodic_timer(&t);
+ *		...
+ *	}
+ */
+
+void init_periodic_timer(PERIODIC_TIMER* t, unsigned period)
+{
+	assert(period > 0);
+	t->period = period;
+	t->next = timer_ticks + period;
+	t->overruns = 0;
+}
+
+/*
+ * Blocks until the next expiry of t and re-arms it. Expiries the
+ * caller was too late for are skipped rather than delivered back to
+ * back; their number is returned and added to t->overruns.
+ */
+int wait_periodic_timer(PERIODIC_TIMER* t)
+{
+	int missed = 0;
+
+	sleep_until(t->next);
+	t->next += t->period;
+	while (tick_reached(t->next)) {
+		t->next += t->period;
+		missed++;
+	}
+	t->overruns += missed;
+	return missed;
 }
 
-// create timer process and timer notifier
+// create timer process and hook it up to the timer interrupt
 void init_timer ()
 {
-	timer_port = create_process(timer_process, 6, 0, 'timer process');
+	timer_port = create_process(timer_process, 6, 0, "timer process");
+	/* keep the server on the CPU that takes the PIT interrupt */
+	set_affinity(timer_port->owner, CPU_MASK(irq_cpu(TIMER_IRQ)));
+	register_port("timer", timer_port);
+	init_tasklet(&timer_tasklet, timer_bottom_half, NULL);
+	set_irq_tasklet(TIMER_IRQ, &timer_tasklet);
 	resign();
 }
@@ -0,0 +1,142 @@
+
+#include <kernel.h>
+
+/*
+ * Scheduler trace
+ *
+ * When the kernel is built with -DTRACE_SCHED, the dispatcher, the
+ * interrupt path and the IPC calls record what they do in a ring of
+ * TRACE_EVENTS entries: context switches, interrupts, state changes and
+ * send, receive and reply, each stamped with the time-stamp counter.
+ * The shell's trace command starts and stops recording and sends the
+ * ring over COM2, where tools/trace turns it into a timeline.
+ *
+ * Once the ring is full the oldest events are overwritten, so it always
+ * holds the most recent ones. A CPU claims a slot by incrementing
+ * trace_next atomically and then fills it in, so recording takes no
+ * lock; the ring is only read after recording has stopped.
+ */
+
+#define TRACE_EVENTS		4096		/* 64K */
+
+static TRACE_EVENT* trace_ring;
+static volatile unsigned trace_next;		/* events recorded so far */
+static volatile BOOL trace_on;
+static unsigned trace_tsc_per_tick;
+
+
+static unsigned long long read_tsc64()
+{
+    unsigned long long tsc;
+
+    asm volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+/* adds 1 to *counter and returns its old value, atomically */
+static unsigned fetch_and_inc(volatile unsigned* counter)
+{
+    unsigned old = 1;
+
+    asm volatile ("lock; xaddl %0,%1"
+		  : "+r" (old), "+m" (*counter) : : "memory");
+    return old;
+}
+
+
+/*
+ * Records an event. Called through TRACE(), from any CPU and from
+ * interrupt context.
+ */
+void trace_event(int type, PROCESS proc, unsigned arg)
+{
+    TRACE_EVENT* e;
+
+    if (!trace_on)
+	return;
+    e = &trace_ring[fetch_and_inc(&trace_next) % TRACE_EVENTS];
+    e->tsc = read_tsc64();
+    e->type = type;
+    e->cpu = this_cpu()->id;
+    e->proc = proc - pcb;
+    e->arg = arg;
+}
+
+
+#ifdef TRACE_SCHED
+
+/* TSC cycles in one timer tick; needs the timer interrupt */
+static unsigned measure_tsc_per_tick()
+{
+    unsigned start, tsc;
+
+    start = timer_ticks;
+    while (timer_ticks == start)
+	;
+    tsc = read_tsc();
+    start = timer_ticks;
+    while (timer_ticks == start)
+	;
+    return read_tsc() - tsc;
+}
+
+#endif
+
+
+/*
+ * Clears the ring and starts recording. Returns FALSE if the kernel was
+ * built without TRACE_SCHED, the CPU has no time-stamp counter or there
+ * is no memory for the ring.
+ */
+BOOL trace_start()
+{
+#ifndef TRACE_SCHED
+    return FALSE;
+#else
+    if (!(cpu_features() & CPU_FEATURE_TSC))
+	return FALSE;
+    if (trace_ring == NULL &&
+	(trace_ring = k_malloc(TRACE_EVENTS * sizeof(TRACE_EVENT))) == NULL)
+	return FALSE;
+    if (trace_tsc_per_tick == 0)
+	trace_tsc_per_tick = measure_tsc_per_tick();
+    trace_on = FALSE;
+    trace_next = 0;
+    trace_on = TRUE;
+    return TRUE;
+#endif
+}
+
+
+void trace_stop()
+{
+    trace_on = FALSE;
+}
+
+
+/*
+ * Stops recording and sends the ring over COM2 by polling. This takes
+ * a few seconds; the rest of the system keeps running meanwhile.
+ */
+void trace_dump()
+{
+    TRACE_HEADER header;
+    unsigned first, last, i;
+
+    trace_stop();
+    last = trace_next;
+    first = last > TRACE_EVENTS ? last - TRACE_EVENTS : 0;
+
+    k_memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.tsc_per_tick = trace_tsc_per_tick;
+    header.num_procs = MAX_PROCS;
+    header.num_events = last - first;
+    header.lost_events = first;
+
+    init_dump_port();
+    dump_write(&header, sizeof(header));
+    dump_proc_names(TRACE_NAME_LEN);
+    for (i = first; i != last; i++)
+	dump_write(&trace_ring[i % TRACE_EVENTS], sizeof(TRACE_EVENT));
+}
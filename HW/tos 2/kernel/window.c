@@ -3,47 +3,81 @@
 #define MEMORY_START 0xb8000
 #define LINE_MEMORY_CAPACITY 160
 #define SCREEN_WIDTH 80
+#define SCREEN_HEIGHT 25
 
 MEM_ADDR get_addr(int x, int y)
 {
 	return MEMORY_START + (y * SCREEN_WIDTH + x) * 2;
 }
 
-/* calculate the starting address of the window */
-MEM_ADDR get_window_start_addr(WINDOW* wnd)
+
+/*
+ * Window manager
+ *
+ * Windows registered with open_window() own an off-screen backing store
+ * and are kept in a z-ordered list (topmost first). screen_owner[][]
+ * records which managed window is visible at each screen location, so
+ * a write only reaches video memory if the cell is not covered by a
+ * window above it. Windows that were never opened (such as
+ * kernel_window) are unmanaged and write straight to video memory;
+ * the window manager never erases what they wrote.
+ */
+WINDOW* top_window = NULL;
+static WINDOW* screen_owner[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+
+/* colour attribute used for all cells written through window wnd */
+BYTE get_window_color(WINDOW* wnd)
 {
-    return get_addr(wnd->x, wnd->y);
+    return (wnd->color != 0) ? wnd->color : DEFAULT_COLOR;
 }
 
-/* calculate the end address of the window */
-MEM_ADDR get_window_end_addr(WINDOW* wnd)
+/* does window wnd cover screen location (x,y)? */
+BOOL window_contains(WINDOW* wnd, int x, int y)
 {
-    return get_addr(wnd->x + wnd->width, wnd->y + wnd->height); 
+    return x >= wnd->x && x < wnd->x + wnd->width &&
+           y >= wnd->y && y < wnd->y + wnd->height;
 }
 
-/* claculate the memory address for the current cursor location */
-MEM_ADDR get_cursor_addr(WINDOW* wnd)
+/* is window location (x,y) of wnd visible on the screen? */
+BOOL is_cell_visible(WINDOW* wnd, int x, int y)
 {
-    return get_addr(wnd->x + wnd->cursor_x, wnd->y + wnd->cursor_y);
+    x += wnd->x;
+    y += wnd->y;
+    if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT)
+    	return FALSE;
+    return wnd->backing == NULL || screen_owner[y][x] == wnd;
 }
 
+/* write a cell at window location (x,y), to the backing store if the
+   window has one and to the screen if the location is visible */
+void poke_cell(WINDOW* wnd, int x, int y, CELL cell)
+{
+    if (wnd->backing != NULL)
+    	wnd->backing[y * wnd->width + x] = cell;
+    if (is_cell_visible(wnd, x, y))
+    	poke_w(get_addr(wnd->x + x, wnd->y + y), cell);
+}
 
-void poke_w_char(MEM_ADDR addr, char c)
+/* read the cell at window location (x,y) */
+CELL peek_cell(WINDOW* wnd, int x, int y)
 {
-	static const WORD BRIGHT_WHITE = 0x0f00;
-    poke_w(addr, c | BRIGHT_WHITE);
+    if (wnd->backing != NULL)
+    	return wnd->backing[y * wnd->width + x];
+    return peek_w(get_addr(wnd->x + x, wnd->y + y));
 }
 
-void clear_word(MEM_ADDR addr)
+void poke_w_char(WINDOW* wnd, int x, int y, char c)
 {
-    poke_w_char(addr, ' ');
+    poke_cell(wnd, x, y, MAKE_CELL(c, get_window_color(wnd)));
 }
 
 void clear_screen(WINDOW* wnd)
 {
-    MEM_ADDR i; 
-    for(i = get_window_start_addr(wnd); i < get_window_end_addr(wnd); clear_word(i), i += 2) 
-	;
+    int x, y;
+    for (y = 0; y < wnd->height; y++)
+    	for (x = 0; x < wnd->width; x++)
+    	    poke_w_char(wnd, x, y, ' ');
 }
 
 void move_cursor(WINDOW* wnd, int x, int y)
@@ -56,14 +90,14 @@ void move_cursor(WINDOW* wnd, int x, int y)
 /* remove the cursor by displaying a blank character at its location */
 void remove_cursor(WINDOW* wnd)
 {
-    poke_w_char(get_cursor_addr(wnd), ' ');
+    poke_w_char(wnd, wnd->cursor_x, wnd->cursor_y, ' ');
 }
 
 
 /* display the cursor character at current location */
 void show_cursor(WINDOW* wnd)
 {
-    poke_w_char(get_cursor_addr(wnd), wnd->cursor_char);   
+    poke_w_char(wnd, wnd->cursor_x, wnd->cursor_y, wnd->cursor_char);   
 }
 
 /* clear the window content and move the cursor to the top left corner (0,0) */
@@ -79,24 +113,178 @@ void clear_window(WINDOW* wnd)
     ENABLE_INTR(saved_if);
 }
 
-void copy_w(MEM_ADDR src, MEM_ADDR des) 
+/* set the colour attribute used for subsequent output to the window */
+void set_window_color(WINDOW* wnd, BYTE color)
 {
-    WORD value = peek_w(src);
-    poke_w(des, value);
+    wnd->color = color;
 }
 
-/* copy line
-   Note: the sequence is from line start to line end */
-void copy_line(MEM_ADDR src, MEM_ADDR des, int length)
+/* write a run of pre-attributed cells starting at window location (x,y)
+   Note: the run is clipped at the right border of the window and the
+   cursor is not moved */
+void output_cells(WINDOW* wnd, int x, int y, const CELL* cells, int len)
 {
-    int i;
-    for(i = 0; i < length; i++) {
-    	copy_w(src, des);
-		src += 2;
-		des += 2;		
-	}
+	int i;
+	volatile int saved_if;
+
+    assert(x >= 0 && x < wnd->width && y >= 0 && y < wnd->height);
+    if (len > wnd->width - x)
+    	len = wnd->width - x;
+    if (len <= 0)
+    	return;
+
+    DISABLE_INTR(saved_if);
+    if (wnd->backing == NULL) {
+    	k_memcpy((void*) get_addr(wnd->x + x, wnd->y + y), cells, len * sizeof(CELL));
+    } else {
+    	k_memcpy(&wnd->backing[y * wnd->width + x], cells, len * sizeof(CELL));
+    	for (i = 0; i < len; i++)
+    	    if (is_cell_visible(wnd, x + i, y))
+    	    	poke_w(get_addr(wnd->x + x + i, wnd->y + y), cells[i]);
+    }
+    ENABLE_INTR(saved_if);
+}
+
+
+/* the topmost managed window covering screen location (x,y) */
+WINDOW* find_top_window(int x, int y)
+{
+    WINDOW* wnd;
+    for (wnd = top_window; wnd != NULL; wnd = wnd->below)
+    	if (window_contains(wnd, x, y))
+    	    return wnd;
+    return NULL;
+}
+
+/* recompute the owner of every screen cell in the given rectangle and
+   repaint only the cells whose owner changed. Cells owned by window
+   force are repainted regardless (its contents moved). Cells no managed
+   window covers any more are left to the unmanaged windows. */
+void update_screen_region(int x0, int y0, int width, int height, WINDOW* force)
+{
+    int x, y, x1, y1;
+    WINDOW* owner;
+    CELL cell;
+
+    x1 = x0 + width;
+    y1 = y0 + height;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > SCREEN_WIDTH) x1 = SCREEN_WIDTH;
+    if (y1 > SCREEN_HEIGHT) y1 = SCREEN_HEIGHT;
+
+    for (y = y0; y < y1; y++) {
+    	for (x = x0; x < x1; x++) {
+    	    owner = find_top_window(x, y);
+    	    if (owner == screen_owner[y][x] && owner != force)
+    	    	continue;
+    	    screen_owner[y][x] = owner;
+    	    if (owner == NULL)
+    	    	continue;
+    	    cell = owner->backing[(y - owner->y) * owner->width + (x - owner->x)];
+    	    poke_w(get_addr(x, y), cell);
+    	}
+    }
+}
+
+/* unlink wnd from the z-order list */
+void unlink_window(WINDOW* wnd)
+{
+    WINDOW** link;
+    for (link = &top_window; *link != NULL; link = &(*link)->below) {
+    	if (*link == wnd) {
+    	    *link = wnd->below;
+    	    break;
+    	}
+    }
+    wnd->below = NULL;
+}
+
+/* put wnd on top of the z-order and paint the cells it now exposes */
+void raise_window(WINDOW* wnd)
+{
+	volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    assert(wnd->backing != NULL);
+    if (top_window != wnd) {
+    	unlink_window(wnd);
+    	wnd->below = top_window;
+    	top_window = wnd;
+    	update_screen_region(wnd->x, wnd->y, wnd->width, wnd->height, NULL);
+    }
+    ENABLE_INTR(saved_if);
+}
+
+/* make wnd a managed window on top of all others. backing must hold
+   wnd->width * wnd->height cells and is initialized to blanks */
+void open_window(WINDOW* wnd, CELL* backing)
+{
+	int i;
+	volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    assert(wnd->backing == NULL);
+    for (i = 0; i < wnd->width * wnd->height; i++)
+    	backing[i] = MAKE_CELL(' ', get_window_color(wnd));
+    wnd->backing = backing;
+    wnd->below = top_window;
+    top_window = wnd;
+    update_screen_region(wnd->x, wnd->y, wnd->width, wnd->height, wnd);
+    ENABLE_INTR(saved_if);
+}
+
+/* remove wnd from the window manager and repaint what it covered */
+void close_window(WINDOW* wnd)
+{
+	volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    assert(wnd->backing != NULL);
+    unlink_window(wnd);
+    wnd->backing = NULL;
+    update_screen_region(wnd->x, wnd->y, wnd->width, wnd->height, NULL);
+    ENABLE_INTR(saved_if);
 }
 
+/* move managed window wnd to screen location (x,y). Only the exposed
+   part of the old rectangle and the new rectangle are repainted */
+void move_window(WINDOW* wnd, int x, int y)
+{
+	int old_x, old_y;
+	volatile int saved_if;
+
+    DISABLE_INTR(saved_if);
+    assert(wnd->backing != NULL);
+    old_x = wnd->x;
+    old_y = wnd->y;
+    wnd->x = x;
+    wnd->y = y;
+    update_screen_region(old_x, old_y, wnd->width, wnd->height, NULL);
+    update_screen_region(x, y, wnd->width, wnd->height, wnd);
+    ENABLE_INTR(saved_if);
+}
+
+
+/*
+ * The status line for fatal errors. Its backing store is static, as
+ * the heap may be what failed.
+ */
+static WINDOW error_window_def = {0, 24, 80, 1, 0, 0, ' '};
+static CELL error_backing[80];
+
+/* put the cleared error line on top of all other windows */
+WINDOW* open_error_window()
+{
+    if (error_window_def.backing == NULL)
+    	open_window(&error_window_def, error_backing);
+    else
+    	raise_window(&error_window_def);
+    clear_window(&error_window_def);
+    return &error_window_def;
+}
+
+
 /* scroll down the window by coping memory, discard the first line of the window */
 void scroll_down(WINDOW* wnd)
 {
@@ -104,14 +292,14 @@ void scroll_down(WINDOW* wnd)
 	volatile int saved_if;
 
 	DISABLE_INTR(saved_if);
-	for (y = wnd->y; y < wnd->y + wnd->height - 1; y++) {
-		for (x = wnd->x; x < wnd->x + wnd->width; x++) {
-			poke_w(get_addr(x, y), peek_w(get_addr(x, y + 1)));
+	for (y = 0; y < wnd->height - 1; y++) {
+		for (x = 0; x < wnd->width; x++) {
+			poke_cell(wnd, x, y, peek_cell(wnd, x, y + 1));
 		}
 	}
-	// y = wnd->y + wnd->height - 1;
-	for (x = wnd->x; x < wnd->x + wnd->width; x++) {
-		poke_w_char(get_addr(x, y), ' ');
+	// y = wnd->height - 1;
+	for (x = 0; x < wnd->width; x++) {
+		poke_w_char(wnd, x, y, ' ');
 	}
     
     // move cursor accordingly
@@ -161,7 +349,7 @@ void output_char(WINDOW* wnd, unsigned char c)
 			}
 			break;
 		default:
-			poke_w_char(get_cursor_addr(wnd), c);
+			poke_w_char(wnd, wnd->cursor_x, wnd->cursor_y, c);
 			wnd->cursor_x++;
 			if(wnd->cursor_x == wnd->width) {
 				wnd->cursor_x = 0;
@@ -24,6 +24,7 @@ void test_reset()
     init_process();
     init_dispatcher();
     init_ipc();
+    init_names();
 
     /*
      * Normally we would call the following init_*(), but the way some
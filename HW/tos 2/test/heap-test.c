@@ -0,0 +1,193 @@
+
+/*
+ * Host tests for the kernel heap (kernel/heap.c). The heap is placed
+ * in a static arena; failed assertions and wprintf() are routed to
+ * stdio.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/kernel.h"
+
+#define TEST_OK 0
+
+#define ARENA_SIZE (1024 * 1024)
+#define NUM_SMALL 1000
+#define SMALL_SIZE(i) (1 + (i) * 37 % 512)
+
+static char arena[ARENA_SIZE + 4096];
+
+int test_heap_small();
+int test_heap_large();
+int test_heap_exhaust();
+int test_heap_coalesce();
+
+#define RUN_TEST(t) \
+{ \
+	int result = t();			\
+	if (result != TEST_OK) {			\
+		printf("test %s failed\n", #t);		\
+		return (result);			\
+	}						\
+}
+
+int failed_assertion(const char* ex, const char* file, int line)
+{
+	printf("Failed assertion '%s' at line %d of %s\n", ex, line, file);
+	exit(1);
+	return 0;
+}
+
+void panic_mode(const char* msg, const char* file, int line)
+{
+	printf("PANIC: '%s' at line %d of %s\n", msg, line, file);
+	exit(1);
+}
+
+void wprintf(WINDOW* wnd, const char* fmt, ...)
+{
+	va_list argp;
+
+	va_start(argp, fmt);
+	vprintf(fmt, argp);
+	va_end(argp);
+}
+
+int main()
+{
+	RUN_TEST(test_heap_small);
+	RUN_TEST(test_heap_large);
+	RUN_TEST(test_heap_exhaust);
+	RUN_TEST(test_heap_coalesce);
+
+	printf("All tests passed!\n");
+	print_heap_stats(NULL);
+	return (0);
+}
+
+/* a fresh heap of exactly ARENA_SIZE bytes */
+static void init_arena()
+{
+	unsigned long start = ((unsigned long) arena + 4095) & ~4095UL;
+
+	init_heap_region((void*) start, ARENA_SIZE);
+}
+
+/* everything but the pages kept by the size classes is free again */
+static int heap_is_empty()
+{
+	HEAP_STATS s;
+
+	get_heap_stats(&s);
+	return s.free_bytes == s.heap_size - s.small_pages * 4096 &&
+	       s.small_allocated == 0 && s.large_allocated == 0;
+}
+
+/* small objects are distinct, aligned to their size class and usable */
+int test_heap_small()
+{
+	static char* p[NUM_SMALL];
+	int i, size, j;
+
+	init_arena();
+	for (i = 0; i < NUM_SMALL; i++) {
+		size = SMALL_SIZE(i);
+		p[i] = k_malloc(size);
+		if (p[i] == NULL)
+			return 1;
+		if (((unsigned long) p[i] & 15) != 0)
+			return 2;
+		k_memset(p[i], i, size);
+	}
+	for (i = 0; i < NUM_SMALL; i++) {
+		size = SMALL_SIZE(i);
+		for (j = 0; j < size; j++)
+			if (p[i][j] != (char) i)
+				return 3;
+	}
+	for (i = 0; i < NUM_SMALL; i += 2)
+		k_free(p[i]);
+	for (i = 0; i < NUM_SMALL; i += 2)
+		if ((p[i] = k_malloc(SMALL_SIZE(i))) == NULL)
+			return 4;
+	for (i = 0; i < NUM_SMALL; i++)
+		k_free(p[i]);
+	if (!heap_is_empty())
+		return 5;
+	return TEST_OK;
+}
+
+/* large blocks are page aligned and do not overlap */
+int test_heap_large()
+{
+	char *a, *b, *c;
+
+	init_arena();
+	a = k_malloc(3000);
+	b = k_malloc(5000);
+	c = k_malloc(64 * 1024);
+	if (a == NULL || b == NULL || c == NULL)
+		return 1;
+	if (((unsigned long) b & 4095) != 0 || ((unsigned long) c & 4095) != 0)
+		return 2;
+	k_memset(b, 0x11, 5000);
+	k_memset(c, 0x22, 64 * 1024);
+	if (b[4999] != 0x11 || c[0] != 0x22)
+		return 3;
+	k_free(c);
+	k_free(a);
+	k_free(b);
+	if (!heap_is_empty())
+		return 4;
+	return TEST_OK;
+}
+
+/* requests that cannot be satisfied return NULL */
+int test_heap_exhaust()
+{
+	HEAP_STATS s;
+	char* p;
+
+	init_arena();
+	if (k_malloc(0) != NULL || k_malloc(-1) != NULL)
+		return 1;
+	if (k_malloc(2 * ARENA_SIZE) != NULL)
+		return 2;
+	p = k_malloc(ARENA_SIZE);
+	if (p == NULL)
+		return 3;
+	if (k_malloc(16) != NULL)
+		return 4;
+	k_free(p);
+	get_heap_stats(&s);
+	if (s.num_failed != 2 || s.largest_free != ARENA_SIZE)
+		return 5;
+	return TEST_OK;
+}
+
+/* freeing all pages merges the buddies back into one block */
+int test_heap_coalesce()
+{
+	static char* p[ARENA_SIZE / 4096 + 1];
+	HEAP_STATS s;
+	int i, n;
+
+	init_arena();
+	for (n = 0; (p[n] = k_malloc(4096)) != NULL; n++)
+		;
+	if (n != ARENA_SIZE / 4096)
+		return 1;
+	/* free every other page: nothing can merge */
+	for (i = 0; i < n; i += 2)
+		k_free(p[i]);
+	get_heap_stats(&s);
+	if (s.largest_free != 4096 || s.free_bytes != ARENA_SIZE / 2)
+		return 2;
+	for (i = 1; i < n; i += 2)
+		k_free(p[i]);
+	get_heap_stats(&s);
+	if (s.largest_free != ARENA_SIZE || s.free_blocks[0] != 0)
+		return 3;
+	return TEST_OK;
+}
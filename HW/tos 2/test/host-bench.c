@@ -0,0 +1,500 @@
+
+/*
+ * Host-side micro-benchmarks for the portable parts of the kernel.
+ *
+ * The kernel sources are compiled for the build machine with TOS_HOST
+ * defined and linked into this program. Every benchmark is run for a
+ * number of warmup repetitions, then for a number of measured
+ * repetitions of a fixed number of operations each. The time per
+ * operation of every repetition is recorded and summarised as CSV on
+ * stdout:
+ *
+ *	group,benchmark,param,reps,iters,min_ns,p50_ns,p90_ns,p99_ns,mean_ns
+ *
+ * USAGE: host-bench [-w warmup] [-r reps] [fat-image]
+ *
+ * The FAT benchmarks are only run if a FAT image containing the file
+ * /BENCH.BIN is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/kernel.h"
+#include <fs.h>
+
+
+/*
+ * The formatter of window.c. It is not declared in kernel.h, and its
+ * name clashes with the C library's declaration in <stdio.h>.
+ */
+void tos_vsprintf(char *buf, const char *fmt, va_list argp) asm ("vsprintf");
+char *printnum(char *b, unsigned int u, int base,
+	       BOOL negflag, int length, BOOL ladjust,
+	       char padc, BOOL upcase);
+
+TOS_Error fs_get_file_size (FAT_FD fd, TOS_UInt32* size);
+
+
+/*
+ * Target duration of one measured repetition. The number of operations
+ * per repetition is calibrated so that a repetition takes about this long.
+ */
+#define TARGET_REP_NS	200000.0
+
+#define MAX_REPS	1000
+
+typedef void (*BENCH_FN) (void* arg, long iters);
+
+static int warmup_reps = 5;
+static int measured_reps = 50;
+
+/* keeps the compiler from discarding results */
+volatile long bench_sink;
+
+
+static double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double time_rep(BENCH_FN fn, void* arg, long iters)
+{
+	double start = now_ns();
+	fn(arg, iters);
+	return now_ns() - start;
+}
+
+static int compare_double(const void* a, const void* b)
+{
+	double d = *(const double*) a - *(const double*) b;
+	return (d > 0) - (d < 0);
+}
+
+/* value at percentile p of the sorted samples */
+static double percentile(double* sorted, int n, int p)
+{
+	int i = (p * (n - 1) + 50) / 100;
+	return sorted[i];
+}
+
+static void run_bench(const char* group, const char* name,
+		      const char* param, BENCH_FN fn, void* arg)
+{
+	double samples[MAX_REPS];
+	double t, sum;
+	long iters;
+	int i;
+
+	/* calibrate: double the number of operations until a
+	   repetition takes long enough to be measured reliably */
+	for (iters = 1; iters < (1L << 30); iters *= 2) {
+		t = time_rep(fn, arg, iters);
+		if (t >= TARGET_REP_NS)
+			break;
+	}
+
+	for (i = 0; i < warmup_reps; i++)
+		time_rep(fn, arg, iters);
+
+	sum = 0;
+	for (i = 0; i < measured_reps; i++) {
+		samples[i] = time_rep(fn, arg, iters) / iters;
+		sum += samples[i];
+	}
+	qsort(samples, measured_reps, sizeof(double), compare_double);
+
+	printf("%s,%s,%s,%d,%ld,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+	       group, name, param, measured_reps, iters,
+	       samples[0],
+	       percentile(samples, measured_reps, 50),
+	       percentile(samples, measured_reps, 90),
+	       percentile(samples, measured_reps, 99),
+	       sum / measured_reps);
+	fflush(stdout);
+}
+
+
+/*
+ * stdlib.c
+ */
+
+#define MAX_MEM_LEN 65536
+
+static char mem_src[MAX_MEM_LEN + 16];
+static char mem_dst[MAX_MEM_LEN + 16];
+static char mem_set[MAX_MEM_LEN + 16];
+
+static int mem_len;
+static int mem_align;
+
+static void bench_memcpy(void* arg, long iters)
+{
+	while (iters--)
+		k_memcpy(mem_dst, mem_src + mem_align, mem_len);
+}
+
+static void bench_memset(void* arg, long iters)
+{
+	while (iters--)
+		k_memset(mem_set + mem_align, (int) iters, mem_len);
+}
+
+static void bench_memcmp(void* arg, long iters)
+{
+	while (iters--)
+		bench_sink += k_memcmp(mem_dst, mem_src + mem_align, mem_len);
+}
+
+static void bench_strlen(void* arg, long iters)
+{
+	while (iters--)
+		bench_sink += k_strlen(mem_src);
+}
+
+static void run_stdlib_benchmarks()
+{
+	static int sizes[] = { 16, 256, 4096, MAX_MEM_LEN, 0 };
+	char param[32];
+	int s, a;
+
+	/* equal buffers make k_memcmp() scan the whole block */
+	k_memset(mem_src, 'a', sizeof(mem_src));
+	k_memset(mem_dst, 'a', sizeof(mem_dst));
+
+	for (s = 0; sizes[s] != 0; s++) {
+		for (a = 0; a <= 1; a++) {
+			mem_len = sizes[s];
+			mem_align = a;
+			sprintf(param, "len=%d align=%d", mem_len, mem_align);
+			run_bench("stdlib", "k_memcpy", param, bench_memcpy, NULL);
+			run_bench("stdlib", "k_memset", param, bench_memset, NULL);
+			run_bench("stdlib", "k_memcmp", param, bench_memcmp, NULL);
+		}
+	}
+
+	mem_src[80] = '\0';
+	run_bench("stdlib", "k_strlen", "len=80", bench_strlen, NULL);
+	mem_src[80] = 'a';
+}
+
+
+/*
+ * window.c formatter
+ */
+
+static void bench_vsprintf_helper(const char* fmt, ...)
+{
+	char buf[160];
+	va_list argp;
+
+	va_start(argp, fmt);
+	tos_vsprintf(buf, fmt, argp);
+	va_end(argp);
+	bench_sink += buf[0];
+}
+
+static void bench_vsprintf_int(void* arg, long iters)
+{
+	while (iters--)
+		bench_vsprintf_helper("%d", (int) iters);
+}
+
+static void bench_vsprintf_hex(void* arg, long iters)
+{
+	while (iters--)
+		bench_vsprintf_helper("%08x", (unsigned) iters);
+}
+
+static void bench_vsprintf_mixed(void* arg, long iters)
+{
+	while (iters--)
+		bench_vsprintf_helper("%-25s%-22s%-5d\n",
+				      "Boot process", "READY", (int) iters & 7);
+}
+
+static void bench_printnum(void* arg, long iters)
+{
+	char buf[64];
+
+	while (iters--) {
+		printnum(buf, (unsigned) iters, 10, FALSE, 0, FALSE, ' ', FALSE);
+		bench_sink += buf[0];
+	}
+}
+
+static void run_window_benchmarks()
+{
+	run_bench("window", "vsprintf", "%d", bench_vsprintf_int, NULL);
+	run_bench("window", "vsprintf", "%08x", bench_vsprintf_hex, NULL);
+	run_bench("window", "vsprintf", "process table row",
+		  bench_vsprintf_mixed, NULL);
+	run_bench("window", "printnum", "base=10", bench_printnum, NULL);
+}
+
+
+/*
+ * heap.c
+ */
+
+#define HEAP_ARENA_SIZE (4 * 1024 * 1024)
+#define HEAP_WORKING_SET 64
+
+static void bench_heap_alloc_free(void* arg, long iters)
+{
+	int size = *(int*) arg;
+	void* p;
+
+	while (iters--) {
+		p = k_malloc(size);
+		k_free(p);
+	}
+}
+
+/* frees and reallocates objects of mixed sizes out of a working set */
+static void bench_heap_mixed(void* arg, long iters)
+{
+	static void* set[HEAP_WORKING_SET];
+	int i;
+
+	while (iters--) {
+		i = iters % HEAP_WORKING_SET;
+		k_free(set[i]);
+		set[i] = k_malloc(16 << (iters % 11));
+	}
+}
+
+static void run_heap_benchmarks()
+{
+	static int sizes[] = { 16, 256, 2048, 4096, 65536, 0 };
+	static char arena[HEAP_ARENA_SIZE];
+	char param[32];
+	int s;
+
+	init_heap_region(arena, sizeof(arena));
+	for (s = 0; sizes[s] != 0; s++) {
+		sprintf(param, "size=%d", sizes[s]);
+		run_bench("heap", "k_malloc+k_free", param,
+			  bench_heap_alloc_free, &sizes[s]);
+	}
+	run_bench("heap", "k_malloc+k_free", "mixed 16..16384",
+		  bench_heap_mixed, NULL);
+}
+
+
+/*
+ * names.c
+ */
+
+#define BENCH_NAMES 32
+
+static void bench_lookup_port(void* arg, long iters)
+{
+	const char* name = arg;
+
+	while (iters--)
+		lookup_port(name);
+}
+
+static void bench_lookup_port_cached(void* arg, long iters)
+{
+	PORT_REF* ref = arg;
+
+	while (iters--)
+		lookup_port_cached(ref);
+}
+
+static void run_names_benchmarks()
+{
+	static PORT_DEF ports[BENCH_NAMES];
+	static PORT_REF ref = PORT_REF_INIT("service31");
+	char name[MAX_NAME_LEN + 1];
+	int i;
+
+	init_names();
+	for (i = 0; i < BENCH_NAMES; i++) {
+		sprintf(name, "service%d", i);
+		register_port(name, &ports[i]);
+	}
+	run_bench("names", "lookup_port", "32 names", bench_lookup_port,
+		  "service31");
+	run_bench("names", "lookup_port", "miss", bench_lookup_port,
+		  "no-such-service");
+	run_bench("names", "lookup_port_cached", "32 names",
+		  bench_lookup_port_cached, &ref);
+}
+
+
+/*
+ * dispatch.c ready queue
+ */
+
+static PCB bench_pcb[MAX_PROCS];
+
+static void bench_ready_queue_add_remove(void* arg, long iters)
+{
+	PROCESS p = &bench_pcb[1];
+
+	while (iters--) {
+		add_ready_queue(p);
+		remove_ready_queue(p);
+	}
+}
+
+static void bench_ready_queue_rotate(void* arg, long iters)
+{
+	int n = *(int*) arg;
+	int i;
+
+	while (iters--) {
+		i = iters % n + 1;
+		remove_ready_queue(&bench_pcb[i]);
+		add_ready_queue(&bench_pcb[i]);
+	}
+}
+
+static void bench_dispatcher(void* arg, long iters)
+{
+	while (iters--) {
+		active_proc = dispatcher();
+		bench_sink += active_proc->priority;
+	}
+}
+
+static void run_dispatch_benchmarks()
+{
+	char param[32];
+	int i, n;
+
+	for (i = 0; i < MAX_PROCS; i++) {
+		bench_pcb[i].magic = MAGIC_PCB;
+		bench_pcb[i].used = TRUE;
+		bench_pcb[i].priority = 1;
+	}
+	active_proc = &bench_pcb[0];
+	init_dispatcher();
+
+	run_bench("dispatch", "add+remove_ready_queue", "prio=1",
+		  bench_ready_queue_add_remove, NULL);
+
+	/* a populated queue of n processes at the same priority */
+	n = MAX_PROCS - 1;
+	for (i = 1; i <= n; i++)
+		add_ready_queue(&bench_pcb[i]);
+	sprintf(param, "procs=%d", n + 1);
+	run_bench("dispatch", "remove+add_ready_queue", param,
+		  bench_ready_queue_rotate, &n);
+	run_bench("dispatch", "dispatcher", param, bench_dispatcher, NULL);
+	for (i = 1; i <= n; i++)
+		remove_ready_queue(&bench_pcb[i]);
+}
+
+
+/*
+ * FAT file system
+ */
+
+static TOS_FAT_Device fat_device;
+static TOS_UInt32 fat_file_size;
+static unsigned char* fat_buffer;
+
+static void bench_fat_open_close(void* arg, long iters)
+{
+	FAT_FD fd;
+
+	while (iters--) {
+		fd = fs_open(&fat_device, (TOS_Octet*) "/BENCH.BIN",
+			     TOS_FS_OPEN_MODE_READ);
+		fs_close(fd);
+	}
+}
+
+static void bench_fat_read(void* arg, long iters)
+{
+	FAT_FD fd;
+
+	while (iters--) {
+		fd = fs_open(&fat_device, (TOS_Octet*) "/BENCH.BIN",
+			     TOS_FS_OPEN_MODE_READ);
+		fs_read(fd, fat_buffer, fat_file_size);
+		fs_close(fd);
+	}
+}
+
+static void bench_fat_cluster_walk(void* arg, long iters)
+{
+	TOS_UInt32 cluster;
+
+	while (iters--) {
+		cluster = fs_get_fat_cluster_entry(&fat_device, 2 + iters % 64);
+		bench_sink += cluster;
+	}
+}
+
+static void run_fat_benchmarks(const char* image)
+{
+	char param[32];
+	FAT_FD fd;
+
+	if (!(fp = fopen(image, "rb+"))) {
+		fprintf(stderr, "host-bench: cannot open %s\n", image);
+		exit(1);
+	}
+	fs_init(&fat_device);
+
+	fd = fs_open(&fat_device, (TOS_Octet*) "/BENCH.BIN",
+		     TOS_FS_OPEN_MODE_READ);
+	if (fd < 0) {
+		fprintf(stderr, "host-bench: /BENCH.BIN not found in %s\n", image);
+		exit(1);
+	}
+	fs_get_file_size(fd, &fat_file_size);
+	fs_close(fd);
+	fat_buffer = malloc(fat_file_size);
+
+	run_bench("fat", "fs_open+fs_close", "/BENCH.BIN",
+		  bench_fat_open_close, NULL);
+	sprintf(param, "bytes=%u", fat_file_size);
+	run_bench("fat", "fs_read", param, bench_fat_read, NULL);
+	run_bench("fat", "fs_get_fat_cluster_entry", "FAT12",
+		  bench_fat_cluster_walk, NULL);
+
+	free(fat_buffer);
+	fclose(fp);
+}
+
+
+int main(int argc, char** argv)
+{
+	const char* image = NULL;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			warmup_reps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			measured_reps = atoi(argv[++i]);
+		else
+			image = argv[i];
+	}
+	if (measured_reps < 1 || measured_reps > MAX_REPS) {
+		fprintf(stderr, "host-bench: reps must be between 1 and %d\n",
+			MAX_REPS);
+		return 1;
+	}
+
+	printf("group,benchmark,param,reps,iters,"
+	       "min_ns,p50_ns,p90_ns,p99_ns,mean_ns\n");
+	run_stdlib_benchmarks();
+	run_heap_benchmarks();
+	run_names_benchmarks();
+	run_window_benchmarks();
+	run_dispatch_benchmarks();
+	if (image != NULL)
+		run_fat_benchmarks(image);
+	return 0;
+}
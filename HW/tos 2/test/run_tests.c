@@ -28,11 +28,23 @@ function_pointer tests[] =  {
     test_ipc_4,
     test_ipc_5,
     test_ipc_6,
+    test_ipc_7,
     test_isr_1,
     test_isr_2,
     test_isr_3,
+    test_isr_4,
+    test_isr_5,
+    test_isr_6,
     test_timer_1,
+    test_timer_2,
     test_com_1,
+    test_channel_1,
+    test_timeout_1,
+    test_timeout_2,
+    test_timeout_3,
+    test_sync_1,
+    test_edf_1,
+    test_fpu_1,
     //test_fork_1,
     NULL
 };
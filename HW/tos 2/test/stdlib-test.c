@@ -1,17 +1,29 @@
 
 #include <stdio.h>
+#include <time.h>
 
 extern int k_strlen(const char* str);
 extern void* k_memcpy(void* dst, const void* src, int len);
+extern void* k_memset(void* dst, int c, int len);
 extern int k_memcmp(const void* b1, const void* b2, int len);
+extern int k_mem_enable_sse2();
+extern void k_mem_disable_sse2();
 
 #define TEST_OK 0
 
+/* largest block used by the tests, plus room for misalignment and guards */
+#define MAX_LEN 300
+#define BUF_LEN (MAX_LEN + 64)
+
 int test_strlen_1();
 int test_memcpy_1();
 int test_memcpy_2();
+int test_memcpy_3();
+int test_memset_1();
 int test_memcmp_1();
 int test_memcmp_2();
+int test_memcmp_3();
+void benchmark();
 
 #define RUN_TEST(t) \
 { \
@@ -29,8 +41,19 @@ int main()
 	RUN_TEST(test_memcpy_2);
 	RUN_TEST(test_memcmp_1);
 	RUN_TEST(test_memcmp_2);
+	RUN_TEST(test_memcmp_3);
+	RUN_TEST(test_memcpy_3);
+	RUN_TEST(test_memset_1);
+
+	if (k_mem_enable_sse2()) {
+		RUN_TEST(test_memcpy_3);
+		RUN_TEST(test_memset_1);
+		k_mem_disable_sse2();
+	}
 
 	printf("All tests passed!\n");
+
+	benchmark();
 	return (0);
 }
 
@@ -114,3 +137,170 @@ int test_memcmp_2()
 	return (TEST_OK);
 }
 
+/*
+ * Copy every length up to MAX_LEN between every combination of source
+ * and destination alignment, and check that no byte outside the
+ * destination range was touched.
+ */
+int test_memcpy_3()
+{
+	char src[BUF_LEN];
+	char dst[BUF_LEN];
+	int len, s_off, d_off, i;
+
+	for (i = 0; i < BUF_LEN; i++)
+		src[i] = (char) (i * 7 + 1);
+
+	for (len = 0; len <= MAX_LEN; len++) {
+		for (s_off = 0; s_off < 16; s_off++) {
+			for (d_off = 0; d_off < 16; d_off++) {
+				for (i = 0; i < BUF_LEN; i++)
+					dst[i] = 'x';
+				if (k_memcpy(dst + d_off, src + s_off, len) != dst + d_off)
+					return (1);
+				for (i = 0; i < BUF_LEN; i++) {
+					if (i >= d_off && i < d_off + len) {
+						if (dst[i] != src[s_off + i - d_off])
+							return (2);
+					} else if (dst[i] != 'x') {
+						return (3);
+					}
+				}
+			}
+		}
+	}
+
+	return (TEST_OK);
+}
+
+int test_memset_1()
+{
+	unsigned char dst[BUF_LEN];
+	int len, d_off, i;
+
+	for (len = 0; len <= MAX_LEN; len++) {
+		for (d_off = 0; d_off < 16; d_off++) {
+			for (i = 0; i < BUF_LEN; i++)
+				dst[i] = 'x';
+			if (k_memset(dst + d_off, 0x1a5, len) != dst + d_off)
+				return (1);
+			for (i = 0; i < BUF_LEN; i++) {
+				if (i >= d_off && i < d_off + len) {
+					if (dst[i] != 0xa5)
+						return (2);
+				} else if (dst[i] != 'x') {
+					return (3);
+				}
+			}
+		}
+	}
+
+	return (TEST_OK);
+}
+
+/*
+ * Place a single difference at every position of blocks of various
+ * lengths and alignments; the sign must follow the differing byte
+ * and bytes are compared as unsigned.
+ */
+int test_memcmp_3()
+{
+	unsigned char a1[BUF_LEN];
+	unsigned char a2[BUF_LEN];
+	int len, off, pos, i;
+
+	for (len = 1; len <= 100; len++) {
+		for (off = 0; off < 4; off++) {
+			for (i = 0; i < BUF_LEN; i++)
+				a1[i] = a2[i] = (unsigned char) i;
+			if (k_memcmp(a1 + off, a2 + off, len) != 0)
+				return (1);
+			for (pos = 0; pos < len; pos++) {
+				a2[off + pos] = 0xf0;
+				if (k_memcmp(a1 + off, a2 + off, len) >= 0)
+					return (2);
+				if (k_memcmp(a2 + off, a1 + off, len) <= 0)
+					return (3);
+				a2[off + pos] = a1[off + pos];
+			}
+		}
+	}
+
+	return (TEST_OK);
+}
+
+
+/*
+ * Throughput benchmark
+ */
+
+static char bench_src[65536 + 64];
+static char bench_dst[65536 + 64];
+/* k_memset() writes here, so that bench_dst stays equal to bench_src */
+static char bench_scratch[65536 + 64];
+volatile int bench_sink;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns MB/s for the given operation */
+static double bench_op(int op, int len, int align)
+{
+	int iterations = (32 << 20) / len;
+	double start, elapsed;
+	int i;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		switch (op) {
+		case 0:
+			k_memcpy(bench_dst, bench_src + align, len);
+			break;
+		case 1:
+			k_memset(bench_scratch + align, i, len);
+			break;
+		case 2:
+			bench_sink += k_memcmp(bench_dst, bench_src + align, len);
+			break;
+		}
+	}
+	elapsed = now() - start;
+	return (double) iterations * len / elapsed / (1 << 20);
+}
+
+static void bench_table(const char* title)
+{
+	static int sizes[] = { 16, 64, 256, 1024, 4096, 65536, 0 };
+	static int aligns[] = { 0, 1, 3 };
+	int s, a;
+
+	printf("\n%s\n", title);
+	printf("%8s %6s %12s %12s %12s\n",
+	       "size", "align", "memcpy MB/s", "memset MB/s", "memcmp MB/s");
+	for (s = 0; sizes[s] != 0; s++) {
+		for (a = 0; a < 3; a++) {
+			printf("%8d %6d %12.0f %12.0f %12.0f\n",
+			       sizes[s], aligns[a],
+			       bench_op(0, sizes[s], aligns[a]),
+			       bench_op(1, sizes[s], aligns[a]),
+			       bench_op(2, sizes[s], aligns[a]));
+		}
+	}
+}
+
+void benchmark()
+{
+	/* equal buffers make k_memcmp() scan the whole block */
+	k_memset(bench_src, 'a', sizeof(bench_src));
+	k_memset(bench_dst, 'a', sizeof(bench_dst));
+
+	bench_table("Throughput (rep movsl/stosl)");
+	if (k_mem_enable_sse2()) {
+		bench_table("Throughput (SSE2)");
+		k_mem_disable_sse2();
+	}
+}
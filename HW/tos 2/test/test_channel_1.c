@@ -0,0 +1,94 @@
+
+#include <kernel.h>
+#include <test.h>
+
+/*
+ * Number of items moved through the channel and through message()
+ */
+#define TEST_CHANNEL_1_ITEMS	2000
+#define TEST_CHANNEL_1_RING	64
+
+CHANNEL test_channel_1_ch;
+unsigned test_channel_1_start;
+
+
+void test_channel_1_producer(PROCESS self, PARAM param)
+{
+    PORT consumer_port = (PORT) param;
+    int i;
+
+    attach_channel(test_channel_1_ch, CHANNEL_PRODUCER);
+    if (cpu_features() & CPU_FEATURE_TSC)
+	test_channel_1_start = read_tsc();
+    for (i = 0; i < TEST_CHANNEL_1_ITEMS; i++)
+	channel_write(test_channel_1_ch, &i);
+
+    /* the same number of items, one message() each */
+    for (i = 0; i < TEST_CHANNEL_1_ITEMS; i++)
+	message(consumer_port, (void*) i);
+
+    resign();
+    test_failed(91);
+}
+
+
+void test_channel_1_consumer(PROCESS self, PARAM param)
+{
+    unsigned channel_done, channel_cycles, message_cycles;
+    PROCESS sender;
+    int i, item;
+
+    attach_channel(test_channel_1_ch, CHANNEL_CONSUMER);
+    for (i = 0; i < TEST_CHANNEL_1_ITEMS; i++) {
+	channel_read(test_channel_1_ch, &item);
+	if (item != i)
+	    test_failed(92);
+    }
+    channel_done = (cpu_features() & CPU_FEATURE_TSC) ? read_tsc() : 0;
+    channel_cycles = channel_done - test_channel_1_start;
+    if (channel_count(test_channel_1_ch) != 0)
+	test_failed(93);
+
+    for (i = 0; i < TEST_CHANNEL_1_ITEMS; i++) {
+	item = (int) receive(&sender);
+	if (item != i)
+	    test_failed(94);
+    }
+    /* the producer is blocked in its first message() by now */
+    message_cycles = (cpu_features() & CPU_FEATURE_TSC) ?
+	read_tsc() - channel_done : 0;
+
+    if (cpu_features() & CPU_FEATURE_TSC)
+	kprintf("%d items: channel %d cycles/item, message() %d cycles/item\n",
+		TEST_CHANNEL_1_ITEMS,
+		channel_cycles / TEST_CHANNEL_1_ITEMS,
+		message_cycles / TEST_CHANNEL_1_ITEMS);
+    destroy_channel(test_channel_1_ch);
+    return_to_boot();
+}
+
+
+/*
+ * This test moves a stream of integers from a producer to a consumer
+ * of the same priority, first through a ring channel and then with one
+ * message() per item. The consumer checks that every item arrives in
+ * order and, if the CPU has a time-stamp counter, prints the cost per
+ * item of both paths.
+ */
+void test_channel_1()
+{
+    PORT consumer_port;
+
+    test_reset();
+    init_heap();
+    init_channels();
+
+    test_channel_1_ch = create_channel(TEST_CHANNEL_1_RING, sizeof(int));
+    if (test_channel_1_ch == NULL)
+	test_failed(90);
+
+    consumer_port = create_process(test_channel_1_consumer, 5, 0, "Consumer");
+    create_process(test_channel_1_producer, 5, (PARAM) consumer_port,
+		   "Producer");
+    resign();
+}
@@ -0,0 +1,81 @@
+
+#include <kernel.h>
+#include <test.h>
+
+#define TEST_EDF_1_TICKS	60
+
+int test_edf_1_runs[2];
+int test_edf_1_first;
+
+
+void test_edf_1_periodic(PROCESS self, PARAM param)
+{
+    if (test_edf_1_first < 0)
+	test_edf_1_first = param;
+    while (42) {
+	test_edf_1_runs[param]++;
+	edf_next_period();
+    }
+}
+
+void test_edf_1_hog(PROCESS self, PARAM param)
+{
+    /* never finishes a period */
+    while (42)
+	;
+}
+
+
+/*
+ * This test checks admission control, that the process with the
+ * earliest deadline runs first and that periodic processes get to run
+ * once per period, while a process that overruns its budget misses its
+ * deadlines without starving the boot process.
+ */
+void test_edf_1()
+{
+    PROCESS slow, fast, hog, rejected;
+    unsigned start;
+
+    test_reset();
+    test_edf_1_runs[0] = test_edf_1_runs[1] = 0;
+    test_edf_1_first = -1;
+
+    kprintf("=== test_edf_1 === \n");
+    slow = create_process(test_edf_1_periodic, 1, 0, "Slow")->owner;
+    fast = create_process(test_edf_1_periodic, 1, 1, "Fast")->owner;
+    hog = create_process(test_edf_1_hog, 1, 0, "Hog")->owner;
+    rejected = create_process(test_edf_1_hog, 1, 0, "Rejected")->owner;
+
+    if (set_edf(slow, 20, 0) || set_edf(slow, 20, 21))
+	test_failed(130);
+    if (!set_edf(slow, 20, 2) || !set_edf(fast, 10, 2))
+	test_failed(131);
+
+    resign();
+    if (test_edf_1_first != 1 || test_edf_1_runs[0] != 1 ||
+	test_edf_1_runs[1] != 1)
+	test_failed(132);
+
+    /* the hog would not give the CPU back before the timer runs */
+    if (!set_edf(hog, 5, 1))
+	test_failed(133);
+    /* 9/10 on top of the others is more than a CPU */
+    if (set_edf(rejected, 10, 9) || rejected->edf_period != 0)
+	test_failed(134);
+
+    init_interrupts();
+    start = timer_ticks;
+    while (timer_ticks - start < TEST_EDF_1_TICKS)
+	;
+    if (test_edf_1_runs[1] < TEST_EDF_1_TICKS / 10 ||
+	test_edf_1_runs[0] < TEST_EDF_1_TICKS / 20)
+	test_failed(135);
+    if (slow->edf_misses != 0 || fast->edf_misses != 0 ||
+	hog->edf_misses == 0)
+	test_failed(136);
+
+    set_edf(slow, 0, 0);
+    set_edf(fast, 0, 0);
+    set_edf(hog, 0, 0);
+}
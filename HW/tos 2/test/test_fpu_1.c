@@ -0,0 +1,63 @@
+
+#include <kernel.h>
+#include <test.h>
+
+double test_fpu_1_result[2];
+unsigned test_fpu_1_xmm[2];
+
+
+void test_fpu_1_process(PROCESS self, PARAM param)
+{
+    /* 2.0 on top of its FPU stack and 7 in xmm1 */
+    asm volatile ("fld1; fld1; faddp");
+    if (cpu_features() & CPU_FEATURE_SSE2)
+	asm volatile ("movd %0,%%xmm1" : : "r" (7));
+    resign();
+    asm volatile ("fstpl %0" : "=m" (test_fpu_1_result[1]));
+    if (cpu_features() & CPU_FEATURE_SSE2)
+	asm volatile ("movd %%xmm1,%0" : "=r" (test_fpu_1_xmm[1]));
+    while (42)
+	resign();
+}
+
+
+/*
+ * This test checks that two processes that use the FPU and SSE
+ * registers at the same time each keep their own, and that the FPU
+ * stays with its owner while a process runs that does not use it.
+ */
+void test_fpu_1()
+{
+    test_reset();
+    kprintf("=== test_fpu_1 === \n");
+    init_interrupts();
+    init_fpu();
+    if (!(cpu_features() & CPU_FEATURE_FPU))
+	return;
+
+    test_fpu_1_result[0] = test_fpu_1_result[1] = 0;
+    test_fpu_1_xmm[0] = test_fpu_1_xmm[1] = 0;
+    create_process(test_fpu_1_process, 1, 0, "FPU");
+
+    /* pi on top of the boot process' FPU stack and 42 in xmm1 */
+    asm volatile ("fldpi");
+    if (cpu_features() & CPU_FEATURE_SSE2)
+	asm volatile ("movd %0,%%xmm1" : : "r" (42));
+    resign();
+    asm volatile ("fstpl %0" : "=m" (test_fpu_1_result[0]));
+    if (cpu_features() & CPU_FEATURE_SSE2)
+	asm volatile ("movd %%xmm1,%0" : "=r" (test_fpu_1_xmm[0]));
+    resign();
+
+    if (test_fpu_1_result[0] < 3.1415 || test_fpu_1_result[0] > 3.1416 ||
+	test_fpu_1_result[1] != 2.0)
+	test_failed(150);
+    if ((cpu_features() & CPU_FEATURE_SSE2) &&
+	(test_fpu_1_xmm[0] != 42 || test_fpu_1_xmm[1] != 7))
+	test_failed(151);
+
+    /* the other process no longer uses the FPU */
+    resign();
+    if (this_cpu()->fpu_owner != active_proc)
+	test_failed(152);
+}
@@ -0,0 +1,67 @@
+#include <kernel.h>
+#include <test.h>
+
+
+void test_ipc_7_poster(PROCESS self, PARAM param)
+{
+    PORT port = (PORT) param;
+    PROCESS sender;
+
+    check_process("Receiver", STATE_RECEIVE_BLOCKED, FALSE);
+    if (test_result != 0)
+	test_failed(test_result);
+
+    kprintf("%s: posting an event...\n", self->name);
+    post_event(port);
+    /* handed to the receiver, nothing is left on the port */
+    if (port->posted != 0)
+	test_failed(171);
+    receive(&sender);
+}
+
+void test_ipc_7_receiver(PROCESS self, PARAM param)
+{
+    PORT port = self->first_port;
+    PROCESS sender;
+    int i;
+
+    /* not receive blocked: the events are counted on the port */
+    post_event(port);
+    post_event(port);
+    if (port->posted != 2)
+	test_failed(170);
+    for (i = 0; i < 2; i++) {
+	sender = self;
+	if (receive(&sender) != port || sender != NULL)
+	    test_failed(172);
+    }
+    if (port->posted != 0)
+	test_failed(170);
+
+    /* receive blocked: the event is delivered at once */
+    create_process(test_ipc_7_poster, 4, (PARAM) port, "Poster");
+    sender = self;
+    if (receive(&sender) != port || sender != NULL)
+	test_failed(173);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that post_event() hands an event to a receive
+ * blocked owner as a message with a NULL sender and the port as its
+ * data, and that events posted while the owner is not receive blocked
+ * are counted and received one by one later without blocking.
+ */
+void test_ipc_7()
+{
+    test_reset();
+    check_sum = 0;
+    kprintf("=== test_ipc_7 ===\n");
+    create_process(test_ipc_7_receiver, 5, 0, "Receiver");
+    resign();
+    if (check_sum == 0)
+	test_failed(174);
+}
@@ -0,0 +1,73 @@
+
+#include <kernel.h>
+#include <test.h>
+
+#define TEST_ISR_4_ROUNDS	5
+
+int test_isr_4_wakeups[2];
+unsigned test_isr_4_ticks[2][TEST_ISR_4_ROUNDS];
+
+
+void test_isr_4_waiter(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int i;
+
+    for (i = 0; i < TEST_ISR_4_ROUNDS; i++) {
+	test_isr_4_wakeups[param] += wait_for_interrupt(TIMER_IRQ);
+	test_isr_4_ticks[param][i] = timer_ticks;
+    }
+    check_sum++;
+    /* off the ready queue, so that the boot process gets to run again */
+    receive(&sender);
+}
+
+/* let two waiters wait for TEST_ISR_4_ROUNDS timer interrupts each */
+void test_isr_4_run()
+{
+    check_sum = 0;
+    test_isr_4_wakeups[0] = test_isr_4_wakeups[1] = 0;
+    create_process(test_isr_4_waiter, 5, 0, "Waiter 1");
+    create_process(test_isr_4_waiter, 5, 1, "Waiter 2");
+    resign();
+    if (interrupt_table[TIMER_IRQ] == NULL ||
+	interrupt_table[TIMER_IRQ]->next_blocked == NULL)
+	test_failed(120);
+
+    while (check_sum < 2)
+	;
+    /* the timer line has a handler, so nothing is coalesced */
+    if (test_isr_4_wakeups[0] != TEST_ISR_4_ROUNDS ||
+	test_isr_4_wakeups[1] != TEST_ISR_4_ROUNDS)
+	test_failed(121);
+}
+
+
+/*
+ * This test lets two processes wait for the timer interrupt at the
+ * same time. With the default wake-all mode, both of them have to see
+ * the same ticks. In wake-one mode every tick wakes exactly one of
+ * them, so no tick is seen by both. The boot process keeps the CPU
+ * busy meanwhile.
+ */
+void test_isr_4()
+{
+    int i, j;
+
+    test_reset();
+
+    kprintf("=== test_isr_4 === \n");
+    init_interrupts();
+    test_isr_4_run();
+    for (i = 0; i < TEST_ISR_4_ROUNDS; i++)
+	if (test_isr_4_ticks[0][i] != test_isr_4_ticks[1][i])
+	    test_failed(124);
+
+    set_irq_wake_mode(TIMER_IRQ, IRQ_WAKE_ONE);
+    test_isr_4_run();
+    for (i = 0; i < TEST_ISR_4_ROUNDS; i++)
+	for (j = 0; j < TEST_ISR_4_ROUNDS; j++)
+	    if (test_isr_4_ticks[0][i] == test_isr_4_ticks[1][j])
+		test_failed(125);
+    set_irq_wake_mode(TIMER_IRQ, IRQ_WAKE_ALL);
+}
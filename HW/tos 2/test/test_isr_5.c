@@ -0,0 +1,44 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_isr_5_process(PROCESS self, PARAM param)
+{
+    IRQ_STATS* s = &irq_stats[TIMER_IRQ - IRQ_BASE];
+    unsigned start;
+
+    /* let a few ticks pass with nobody waiting for them */
+    start = timer_ticks;
+    while (timer_ticks - start < 3)
+	;
+    if (s->missed != 0 || s->pending != 0)
+	test_failed(122);
+
+    start = timer_ticks;
+    if (wait_for_interrupt(TIMER_IRQ) != 1 || timer_ticks == start)
+	test_failed(123);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that the interrupts of a line that has a handler
+ * are not counted as missed, so that the first wait_for_interrupt()
+ * on the timer blocks for the next tick rather than returning the
+ * ticks since boot.
+ */
+void test_isr_5()
+{
+    test_reset();
+    check_sum = 0;
+
+    kprintf("=== test_isr_5 === \n");
+    init_interrupts();
+    create_process(test_isr_5_process, 5, 0, "ISR process");
+    resign();
+    while (check_sum == 0)
+	;
+}
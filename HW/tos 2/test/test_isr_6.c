@@ -0,0 +1,66 @@
+
+#include <kernel.h>
+#include <test.h>
+
+/* a line no device drives; its interrupts are raised with int */
+#define TEST_ISR_6_IRQ		IRQ(5)
+
+
+void test_isr_6_raise()
+{
+    asm volatile ("int %0" : : "i" (TEST_ISR_6_IRQ));
+}
+
+void test_isr_6_raiser(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+
+    test_isr_6_raise();
+    receive(&sender);
+}
+
+void test_isr_6_process(PROCESS self, PARAM param)
+{
+    IRQ_STATS* s = &irq_stats[TEST_ISR_6_IRQ - IRQ_BASE];
+
+    /* nobody serves the line, so the interrupts are coalesced */
+    test_isr_6_raise();
+    test_isr_6_raise();
+    test_isr_6_raise();
+    if (s->count != 3 || s->missed != 3 || s->pending != 3)
+	test_failed(126);
+    if (wait_for_interrupt(TEST_ISR_6_IRQ) != 3 || s->pending != 0)
+	test_failed(127);
+
+    /* nothing is pending any more, so this has to block */
+    if (wait_for_interrupt_timeout(TEST_ISR_6_IRQ, 2) != 0)
+	test_failed(128);
+
+    /* an interrupt somebody waits for is neither missed nor pending */
+    create_process(test_isr_6_raiser, 4, 0, "Raiser");
+    if (wait_for_interrupt(TEST_ISR_6_IRQ) != 1 || s->count != 4 ||
+	s->missed != 3 || s->pending != 0)
+	test_failed(129);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that interrupts of a line nobody serves are counted
+ * as missed and returned all at once by the next wait_for_interrupt(),
+ * which then blocks again until the next one.
+ */
+void test_isr_6()
+{
+    test_reset();
+    check_sum = 0;
+
+    kprintf("=== test_isr_6 === \n");
+    init_interrupts();
+    create_process(test_isr_6_process, 5, 0, "ISR process");
+    resign();
+    while (check_sum == 0)
+	;
+}
@@ -0,0 +1,98 @@
+
+#include <kernel.h>
+#include <test.h>
+
+#define TEST_SYNC_1_ITEMS	100
+#define TEST_SYNC_1_SLOTS	4
+
+MUTEX test_sync_1_lock;
+CONDVAR test_sync_1_not_full;
+CONDVAR test_sync_1_not_empty;
+SEMAPHORE test_sync_1_done;
+int test_sync_1_buffer[TEST_SYNC_1_SLOTS];
+int test_sync_1_count;
+int test_sync_1_in, test_sync_1_out;
+
+
+void test_sync_1_producer(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int i;
+
+    for (i = 0; i < TEST_SYNC_1_ITEMS; i++) {
+	mutex_lock(&test_sync_1_lock);
+	while (test_sync_1_count == TEST_SYNC_1_SLOTS)
+	    cond_wait(&test_sync_1_not_full, &test_sync_1_lock);
+	test_sync_1_buffer[test_sync_1_in] = i;
+	test_sync_1_in = (test_sync_1_in + 1) % TEST_SYNC_1_SLOTS;
+	test_sync_1_count++;
+	cond_signal(&test_sync_1_not_empty);
+	mutex_unlock(&test_sync_1_lock);
+    }
+    sem_signal(&test_sync_1_done);
+    /* off the ready queue, so that the boot process gets to run again */
+    receive(&sender);
+}
+
+
+void test_sync_1_consumer(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int i, item;
+
+    for (i = 0; i < TEST_SYNC_1_ITEMS; i++) {
+	mutex_lock(&test_sync_1_lock);
+	while (test_sync_1_count == 0)
+	    cond_wait(&test_sync_1_not_empty, &test_sync_1_lock);
+	item = test_sync_1_buffer[test_sync_1_out];
+	test_sync_1_out = (test_sync_1_out + 1) % TEST_SYNC_1_SLOTS;
+	test_sync_1_count--;
+	cond_signal(&test_sync_1_not_full);
+	mutex_unlock(&test_sync_1_lock);
+	if (item != i)
+	    test_failed(111);
+    }
+    sem_signal(&test_sync_1_done);
+    /* off the ready queue, so that the boot process gets to run again */
+    receive(&sender);
+}
+
+
+/*
+ * This test passes TEST_SYNC_1_ITEMS integers through a small bounded
+ * buffer protected by a mutex and two condition variables. Producer and
+ * consumer run at a higher priority than the boot process, which waits
+ * on a semaphore until both of them are done. It also checks the
+ * uncontended paths of the semaphore and mutex calls.
+ */
+void test_sync_1()
+{
+    SEMAPHORE sem;
+    MUTEX mutex;
+
+    test_reset();
+
+    init_semaphore(&sem, 2);
+    if (!sem_try_wait(&sem) || !sem_try_wait(&sem) || sem_try_wait(&sem))
+	test_failed(110);
+    sem_signal(&sem);
+    sem_wait(&sem);
+    init_mutex(&mutex);
+    if (!mutex_try_lock(&mutex) || mutex_try_lock(&mutex))
+	test_failed(110);
+    mutex_unlock(&mutex);
+
+    init_mutex(&test_sync_1_lock);
+    init_condvar(&test_sync_1_not_full);
+    init_condvar(&test_sync_1_not_empty);
+    init_semaphore(&test_sync_1_done, 0);
+    test_sync_1_count = 0;
+    test_sync_1_in = test_sync_1_out = 0;
+
+    create_process(test_sync_1_consumer, 5, 0, "Consumer");
+    create_process(test_sync_1_producer, 5, 0, "Producer");
+    sem_wait(&test_sync_1_done);
+    sem_wait(&test_sync_1_done);
+    if (test_sync_1_count != 0 || test_sync_1_lock.owner != NULL)
+	test_failed(112);
+}
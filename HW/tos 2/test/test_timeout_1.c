@@ -0,0 +1,65 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_timeout_1_receiver(PROCESS self, PARAM param)
+{
+    /* never receives anything */
+    while (42)
+	resign();
+}
+
+void test_timeout_1_process(PROCESS self, PARAM param)
+{
+    PORT receiver_port = (PORT) param;
+    PROCESS sender;
+    unsigned start;
+    int data = 42;
+
+    kprintf("%s: receive_timeout()...\n", self->name);
+    start = timer_ticks;
+    if (receive_timeout(&sender, 3) != NULL || sender != NULL)
+	test_failed(100);
+    if (timer_ticks - start < 3)
+	test_failed(101);
+
+    kprintf("%s: wait_for_interrupt_timeout()...\n", self->name);
+    if (wait_for_interrupt_timeout(COM1_IRQ, 3))
+	test_failed(102);
+    if (interrupt_table[COM1_IRQ] != NULL)
+	test_failed(103);
+
+    kprintf("%s: send_timeout()...\n", self->name);
+    close_port(receiver_port);
+    if (send_timeout(receiver_port, &data, 3))
+	test_failed(104);
+    if (receiver_port->blocked_list_head != NULL ||
+	receiver_port->blocked_list_tail != NULL)
+	test_failed(105);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that receive_timeout(), wait_for_interrupt_timeout()
+ * and send_timeout() return with an error once their timeout has passed,
+ * and that they leave no trace on the interrupt table or the port's
+ * send blocked list. The boot process keeps the CPU busy meanwhile.
+ */
+void test_timeout_1()
+{
+    PORT receiver_port;
+
+    test_reset();
+    check_sum = 0;
+    init_interrupts();
+    receiver_port = create_process(test_timeout_1_receiver, 1, 0, "Receiver");
+    create_process(test_timeout_1_process, 5, (PARAM) receiver_port,
+		   "Timeout");
+    resign();
+    while (check_sum == 0)
+	;
+}
@@ -0,0 +1,62 @@
+
+#include <kernel.h>
+#include <test.h>
+
+#define TEST_TIMEOUT_2_TICKS	3
+
+
+void test_timeout_2_waker(PROCESS self, PARAM param)
+{
+    PORT receiver_port = (PORT) param;
+    PROCESS receiver = receiver_port->owner;
+    PROCESS sender;
+    unsigned deadline = receiver->timeout_tick;
+
+    /* wake the receiver in the last tick before its timeout... */
+    while ((int) (deadline - timer_ticks) > 1)
+	;
+    if (receiver->state != STATE_RECEIVE_BLOCKED)
+	test_failed(106);
+    post_event(receiver_port);
+
+    /* ...and let the timeout pass before it gets to run */
+    while ((int) (timer_ticks - deadline) < 0)
+	;
+    if (receiver->timed_out || receiver->next != receiver ||
+	receiver->prev != receiver)
+	test_failed(107);
+    receive(&sender);
+}
+
+void test_timeout_2_receiver(PROCESS self, PARAM param)
+{
+    PORT port = self->first_port;
+    PROCESS sender;
+    void* data;
+
+    create_process(test_timeout_2_waker, 3, (PARAM) port, "Waker");
+    data = receive_timeout(&sender, TEST_TIMEOUT_2_TICKS);
+    if (data != port || sender != NULL)
+	test_failed(108);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that a process that is woken up in the same tick its
+ * timeout runs out gets what woke it up, and that the timeout does not
+ * put it on the ready queue a second time.
+ */
+void test_timeout_2()
+{
+    test_reset();
+    check_sum = 0;
+    init_interrupts();
+    kprintf("=== test_timeout_2 ===\n");
+    create_process(test_timeout_2_receiver, 2, 0, "Receiver");
+    resign();
+    while (check_sum == 0)
+	;
+}
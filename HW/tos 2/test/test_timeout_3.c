@@ -0,0 +1,74 @@
+
+#include <kernel.h>
+#include <test.h>
+
+#define TEST_TIMEOUT_3_TICKS	3
+
+BOOL test_timeout_3_replied;
+
+
+/* receives the message, but replies only after the sender has given up */
+void test_timeout_3_late_server(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    PROCESS nobody;
+
+    receive(&sender);
+    receive_timeout(&nobody, 4 * TEST_TIMEOUT_3_TICKS);
+    reply(sender);
+    if (sender->state != STATE_REPLY_BLOCKED)
+	test_failed(161);
+    receive(&sender);
+}
+
+/* receives the next message and replies after the late server did */
+void test_timeout_3_server(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    PROCESS nobody;
+
+    receive(&sender);
+    receive_timeout(&nobody, 8 * TEST_TIMEOUT_3_TICKS);
+    test_timeout_3_replied = TRUE;
+    reply(sender);
+    receive(&sender);
+}
+
+void test_timeout_3_process(PROCESS self, PARAM param)
+{
+    PORT late_port;
+    PORT port;
+    int data = 42;
+
+    late_port = create_process(test_timeout_3_late_server, 4, 0,
+			       "Late server");
+    port = create_process(test_timeout_3_server, 4, 0, "Server");
+
+    if (send_timeout(late_port, &data, TEST_TIMEOUT_3_TICKS))
+	test_failed(160);
+    send(port, &data);
+    if (!test_timeout_3_replied)
+	test_failed(162);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that a reply to a sender that has timed out waiting
+ * for it is ignored, and in particular does not end the sender's next
+ * send() to another port before that one was replied to.
+ */
+void test_timeout_3()
+{
+    test_reset();
+    check_sum = 0;
+    test_timeout_3_replied = FALSE;
+    init_interrupts();
+    kprintf("=== test_timeout_3 ===\n");
+    create_process(test_timeout_3_process, 2, 0, "Sender");
+    resign();
+    while (check_sum == 0)
+	;
+}
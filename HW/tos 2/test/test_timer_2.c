@@ -0,0 +1,64 @@
+
+#include <kernel.h>
+#include <test.h>
+
+#define TEST_TIMER_2_PERIOD	2
+#define TEST_TIMER_2_ROUNDS	10
+
+
+void test_timer_2_process(PROCESS self, PARAM param)
+{
+    PERIODIC_TIMER t;
+    unsigned start, tick;
+    int i;
+
+    /* a tick that has passed does not block */
+    start = timer_ticks;
+    sleep_until(start - 1);
+    if (timer_ticks - start > 1)
+	test_failed(140);
+    sleep_until(start + 3);
+    if ((int) (timer_ticks - (start + 3)) < 0)
+	test_failed(141);
+
+    init_periodic_timer(&t, TEST_TIMER_2_PERIOD);
+    start = t.next;
+    for (i = 0; i < TEST_TIMER_2_ROUNDS; i++) {
+	wait_periodic_timer(&t);
+	if (timer_ticks - (start + i * TEST_TIMER_2_PERIOD) > 1)
+	    test_failed(142);
+	/* about a tick of work, which a relative sleep would add on */
+	tick = timer_ticks;
+	while (timer_ticks == tick)
+	    ;
+    }
+    if (t.next != start + TEST_TIMER_2_ROUNDS * TEST_TIMER_2_PERIOD ||
+	t.overruns != 0)
+	test_failed(143);
+
+    check_sum = 1;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that sleep_until() wakes up at the given tick, and
+ * that a periodic timer keeps its rate even though the process works
+ * for part of each period.
+ */
+void test_timer_2()
+{
+    check_sum = 0;
+
+    test_reset();
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_timer_2 ===\n");
+    create_process(test_timer_2_process, 5, 0, "Periodic");
+    resign();
+    while (check_sum == 0)
+	;
+}
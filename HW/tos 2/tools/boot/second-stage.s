@@ -12,6 +12,12 @@
 %define KERNEL_BASE 0x4000
 %define KERNEL_SEG 0x0400
 
+; This is the location in memory where the BIOS memory map is collected
+; for the kernel (see MEMORY_MAP in include/kernel.h)
+%define MEMORY_MAP_BASE 0x0500
+%define MEMORY_MAP_MAX 32
+%define SMAP 0x534D4150
+
 ; These are the final destinations of various fields in the boot sector
 %define first_data_sector 0800h ; temporary variable
 %define MaxRootEntries 0811h ; maximum number of root directory entries
@@ -205,6 +211,9 @@ donemovingdata:
 	call send_char_com1
 	call delay
 
+	; collect the memory map while the BIOS is still available
+	call get_memory_map
+
 	; reset disk controller
 	xor ax, ax
 	int 13h
@@ -220,6 +229,9 @@ donemovingdata:
 	or ax, 1
 	lmsw ax
 
+	; pass the address of the memory map to kernel_main in ebx
+	mov ebx, MEMORY_MAP_BASE
+
 	; clear pre-fetch queue and start the kernel!
 	jmp flush
 
@@ -228,6 +240,33 @@ flush:
 	dw (KERNEL_BASE & 0xFFFF), (KERNEL_BASE >> 16) ; offset to TOS (lo then hi)
 	dw 8 ; code selector
 
+; collect the BIOS memory map (INT 15h, AX=E820h) at MEMORY_MAP_BASE
+; layout: dword magic ('SMAP'), dword number of entries, followed by
+; up to MEMORY_MAP_MAX entries of 20 bytes each (base, length, type).
+; The number of entries is left at 0 if the BIOS does not support E820.
+
+get_memory_map:
+	mov dword [MEMORY_MAP_BASE], SMAP
+	mov dword [MEMORY_MAP_BASE + 4], 0
+	mov di, MEMORY_MAP_BASE + 8 ; es:di = first entry
+	xor ebx, ebx ; continuation value, 0 = first entry
+.gmm1:
+	mov eax, 0xE820
+	mov ecx, 20 ; size of an entry
+	mov edx, SMAP
+	int 15h
+	jc .gmm2 ; carry = not supported or past the last entry
+	cmp eax, SMAP
+	jne .gmm2
+	inc dword [MEMORY_MAP_BASE + 4]
+	add di, 20
+	test ebx, ebx ; ebx = 0 after the last entry
+	jz .gmm2
+	cmp dword [MEMORY_MAP_BASE + 4], MEMORY_MAP_MAX
+	jb .gmm1
+.gmm2:
+	ret
+
 ; delay loop for serial communications
 
 delay:
@@ -0,0 +1,89 @@
+/*
+ * Reading the dumps the kernel sends over COM2, see dump.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include "dump.h"
+
+
+FILE* dump_in;
+
+
+void die(const char* fmt, ...)
+{
+    va_list argp;
+
+    fprintf(stderr, "%s: ", tool_name);
+    va_start(argp, fmt);
+    vfprintf(stderr, fmt, argp);
+    va_end(argp);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* puts a serial line into raw mode at the kernel's 115200 baud */
+static void setup_tty(int fd)
+{
+    struct termios t;
+
+    if (!isatty(fd))
+	return;
+    if (tcgetattr(fd, &t) < 0)
+	die("cannot read the terminal settings");
+    cfmakeraw(&t);
+    cfsetispeed(&t, B115200);
+    cfsetospeed(&t, B115200);
+    t.c_cflag |= CLOCAL | CREAD;
+    if (tcsetattr(fd, TCSANOW, &t) < 0)
+	die("cannot set the terminal to raw mode");
+}
+
+/* reads the dump from a serial device or file, or stdin if path is NULL */
+void open_dump(const char* path)
+{
+    int fd;
+
+    if (path == NULL) {
+	dump_in = stdin;
+	return;
+    }
+    if ((fd = open(path, O_RDONLY | O_NOCTTY)) < 0) {
+	perror(path);
+	exit(1);
+    }
+    setup_tty(fd);
+    dump_in = fdopen(fd, "rb");
+}
+
+/* skips input up to and including the len bytes of magic */
+void find_magic(const char* magic, size_t len, const char* what)
+{
+    size_t matched = 0;
+    int c;
+
+    while (matched < len) {
+	if ((c = getc(dump_in)) == EOF)
+	    die("no %s found in the input", what);
+	if (c == magic[matched])
+	    matched++;
+	else
+	    matched = (c == magic[0]) ? 1 : 0;
+    }
+}
+
+void read_bytes(unsigned char* buf, size_t len)
+{
+    if (fread(buf, 1, len, dump_in) != len)
+	die("dump is truncated");
+}
+
+/* the dump is little-endian, like the machine that wrote it */
+unsigned get32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24);
+}
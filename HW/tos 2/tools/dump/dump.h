@@ -0,0 +1,22 @@
+/*
+ * Reading the dumps the kernel sends over COM2 (trace, profile)
+ *
+ * Shared by the host tools in tools/trace and tools/profile. Each tool
+ * defines tool_name, which prefixes the error messages.
+ */
+
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdio.h>
+
+extern const char* tool_name;
+extern FILE* dump_in;
+
+void die(const char* fmt, ...);
+void open_dump(const char* path);
+void find_magic(const char* magic, size_t len, const char* what);
+void read_bytes(unsigned char* buf, size_t len);
+unsigned get32(const unsigned char* p);
+
+#endif
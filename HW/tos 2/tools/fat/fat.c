@@ -14,6 +14,9 @@ PORT_ID		floppy_port;
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+
+/* The image file all block I/O goes to */
+FILE* fp;
 #endif
 
 TOS_UInt16 swap16(TOS_UInt16 val)
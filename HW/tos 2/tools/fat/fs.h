@@ -220,7 +220,7 @@ void check_sizeof_types ();
  */
 
 #ifdef FS_STANDALONE
-FILE* fp;
+extern FILE* fp;
 #endif
 
 #define BIO_SECTOR_SIZE 512
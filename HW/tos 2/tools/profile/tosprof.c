@@ -0,0 +1,265 @@
+/*
+ * tosprof: reports where a TOS profile says the time went
+ *
+ * The kernel's "profile dump" shell command sends the sampling
+ * profile over COM2 (see kernel/profile.c): how often each process was
+ * interrupted at each address. This program reads that dump from a
+ * serial device or from a file the emulator wrote COM2 to, looks the
+ * addresses up in the symbol table of the kernel and prints
+ *
+ *   - the samples of each process,
+ *   - the functions that took the most samples, over all processes,
+ *   - the same for each process.
+ *
+ * Usage: tosprof [-n count] kernel-elf [device-or-file]
+ *
+ * The kernel ELF has to be the unstripped one of the running kernel:
+ * tos.elf after "make", or tos.img after "make tests", which is not
+ * stripped. Without a device or file the dump is read from stdin.
+ * Anything in front of the dump, such as boot messages, is skipped.
+ * -n limits the function lists to count lines each (default 20).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "dump.h"
+
+
+/* must match PROFILE_* in include/kernel.h */
+#define PROFILE_MAGIC		"TOSPROF"	/* with the '\0', 8 bytes */
+#define PROFILE_MAGIC_LEN	8
+#define PROFILE_VERSION		1
+#define PROFILE_NAME_LEN	24
+#define PROFILE_HEADER_SIZE	32
+#define PROFILE_BUCKET_SIZE	12
+
+typedef struct {
+    unsigned    addr;
+    const char* name;
+} SYMBOL;
+
+/* samples of one process or all of them, per symbol */
+typedef struct {
+    unsigned  total;
+    unsigned* count;			/* num_symbols + 1, the last unknown */
+} HISTOGRAM;
+
+const char* tool_name = "tosprof";
+
+static SYMBOL* symbols;
+static unsigned num_symbols;
+static char* elf_image;
+
+
+static void* allocate(size_t size)
+{
+    void* p = calloc(1, size);
+
+    if (p == NULL)
+	die("out of memory");
+    return p;
+}
+
+
+static int by_address(const void* a, const void* b)
+{
+    const SYMBOL* x = a;
+    const SYMBOL* y = b;
+
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/*
+ * Reads the code symbols of the kernel: functions, and the labels of
+ * the assembler stubs, which have no type
+ */
+static void read_symbols(const char* path)
+{
+    FILE* f;
+    long size;
+    Elf32_Ehdr* eh;
+    Elf32_Shdr* sh;
+    Elf32_Sym* sym;
+    const char* strtab;
+    unsigned i, j, n, type;
+
+    if ((f = fopen(path, "rb")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    elf_image = allocate(size);
+    if (fread(elf_image, 1, size, f) != (size_t) size)
+	die("cannot read the kernel");
+    fclose(f);
+
+    eh = (Elf32_Ehdr*) elf_image;
+    if (size < sizeof(Elf32_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_machine != EM_386)
+	die("the kernel is not a 32-bit x86 ELF file");
+    if (eh->e_shoff == 0 || eh->e_shoff + eh->e_shnum * sizeof(Elf32_Shdr) > size)
+	die("the kernel has no section table");
+    sh = (Elf32_Shdr*) (elf_image + eh->e_shoff);
+
+    for (i = 0; i < eh->e_shnum && sh[i].sh_type != SHT_SYMTAB; i++)
+	;
+    if (i == eh->e_shnum)
+	die("the kernel is stripped; use tos.elf");
+    sym = (Elf32_Sym*) (elf_image + sh[i].sh_offset);
+    n = sh[i].sh_size / sizeof(Elf32_Sym);
+    strtab = elf_image + sh[sh[i].sh_link].sh_offset;
+
+    symbols = allocate(n * sizeof(SYMBOL));
+    for (j = 0; j < n; j++) {
+	type = ELF32_ST_TYPE(sym[j].st_info);
+	if ((type != STT_FUNC && type != STT_NOTYPE) ||
+	    sym[j].st_shndx == SHN_UNDEF || sym[j].st_shndx >= eh->e_shnum ||
+	    !(sh[sym[j].st_shndx].sh_flags & SHF_EXECINSTR) ||
+	    strtab[sym[j].st_name] == '\0')
+	    continue;
+	symbols[num_symbols].addr = sym[j].st_value;
+	symbols[num_symbols].name = strtab + sym[j].st_name;
+	num_symbols++;
+    }
+    if (num_symbols == 0)
+	die("the kernel has no code symbols");
+    qsort(symbols, num_symbols, sizeof(SYMBOL), by_address);
+}
+
+/* the index of the symbol eip lies in, or num_symbols if none */
+static unsigned find_symbol(unsigned eip)
+{
+    unsigned low = 0, high = num_symbols;
+    unsigned mid;
+
+    if (eip < symbols[0].addr)
+	return num_symbols;
+    /* the last symbol at or below eip */
+    while (high - low > 1) {
+	mid = (low + high) / 2;
+	if (symbols[mid].addr <= eip)
+	    low = mid;
+	else
+	    high = mid;
+    }
+    return low;
+}
+
+
+static HISTOGRAM* sort_histogram;
+
+static int by_count(const void* a, const void* b)
+{
+    unsigned x = sort_histogram->count[*(const unsigned*) a];
+    unsigned y = sort_histogram->count[*(const unsigned*) b];
+
+    return x > y ? -1 : x < y;
+}
+
+static void print_functions(HISTOGRAM* h, unsigned max_lines)
+{
+    unsigned* order = allocate((num_symbols + 1) * sizeof(unsigned));
+    unsigned i, n = 0;
+
+    for (i = 0; i <= num_symbols; i++)
+	if (h->count[i] != 0)
+	    order[n++] = i;
+    sort_histogram = h;
+    qsort(order, n, sizeof(unsigned), by_count);
+
+    printf("  Samples      %%  Function\n");
+    for (i = 0; i < n && i < max_lines; i++)
+	printf("  %7u  %5.1f  %s\n", h->count[order[i]],
+	       100.0 * h->count[order[i]] / h->total,
+	       order[i] == num_symbols ? "(unknown)" : symbols[order[i]].name);
+    if (n > max_lines)
+	printf("  ... %u more\n", n - max_lines);
+    free(order);
+}
+
+
+int main(int argc, char** argv)
+{
+    unsigned char header[PROFILE_HEADER_SIZE - PROFILE_MAGIC_LEN];
+    unsigned char b[PROFILE_BUCKET_SIZE];
+    unsigned version, hz, num_procs, num_buckets, samples, dropped;
+    unsigned max_lines = 20;
+    unsigned i, eip, proc, count, sym;
+    char (*proc_name)[PROFILE_NAME_LEN + 1];
+    HISTOGRAM all, *per_proc;
+    int arg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+	max_lines = atoi(argv[2]);
+	arg = 3;
+    }
+    if (argc - arg < 1 || argc - arg > 2) {
+	fprintf(stderr, "usage: tosprof [-n count] kernel-elf [device-or-file]\n");
+	return 2;
+    }
+    read_symbols(argv[arg]);
+    open_dump(argc - arg == 2 ? argv[arg + 1] : NULL);
+
+    /* the magic with its '\0' */
+    find_magic(PROFILE_MAGIC, PROFILE_MAGIC_LEN, "profile");
+    read_bytes(header, sizeof(header));
+    version = get32(header);
+    hz = get32(header + 4);
+    num_procs = get32(header + 8);
+    num_buckets = get32(header + 12);
+    samples = get32(header + 16);
+    dropped = get32(header + 20);
+    if (version != PROFILE_VERSION)
+	die("unknown profile version");
+
+    proc_name = allocate(num_procs * sizeof(*proc_name));
+    for (i = 0; i < num_procs; i++)
+	read_bytes((unsigned char*) proc_name[i], PROFILE_NAME_LEN);
+    all.total = 0;
+    all.count = allocate((num_symbols + 1) * sizeof(unsigned));
+    per_proc = allocate(num_procs * sizeof(HISTOGRAM));
+    for (i = 0; i < num_procs; i++)
+	per_proc[i].count = allocate((num_symbols + 1) * sizeof(unsigned));
+
+    for (i = 0; i < num_buckets; i++) {
+	read_bytes(b, sizeof(b));
+	eip = get32(b);
+	proc = b[4] | (b[5] << 8);
+	count = get32(b + 8);
+	if (proc >= num_procs)
+	    die("corrupt bucket");
+	sym = find_symbol(eip);
+	all.total += count;
+	all.count[sym] += count;
+	per_proc[proc].total += count;
+	per_proc[proc].count[sym] += count;
+    }
+
+    printf("%u samples", samples);
+    if (hz != 0)
+	printf(" in %.1f s", (double) samples / hz);
+    printf(", %u dropped\n", dropped);
+    if (all.total == 0)
+	return 0;
+
+    printf("\n  Samples      %%  Process\n");
+    for (i = 0; i < num_procs; i++)
+	if (per_proc[i].total != 0)
+	    printf("  %7u  %5.1f  %s\n", per_proc[i].total,
+		   100.0 * per_proc[i].total / all.total,
+		   proc_name[i][0] != '\0' ? proc_name[i] : "(exited)");
+
+    printf("\nAll processes:\n");
+    print_functions(&all, max_lines);
+    for (i = 0; i < num_procs; i++) {
+	if (per_proc[i].total == 0)
+	    continue;
+	printf("\n%s:\n", proc_name[i][0] != '\0' ? proc_name[i] : "(exited)");
+	print_functions(&per_proc[i], max_lines);
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * trace2json: converts a TOS scheduler trace to Chrome trace JSON
+ *
+ * The kernel's "trace dump" shell command sends the trace ring over
+ * COM2 (see kernel/trace.c). This program reads that dump from a
+ * serial device or from a file the emulator wrote COM2 to, and writes
+ * a JSON file that chrome://tracing or https://ui.perfetto.dev shows
+ * as a timeline:
+ *
+ *   - one track per CPU with the process running on it,
+ *   - one track per process with the state it was in,
+ *   - interrupts and IPC calls as instant events.
+ *
+ * Usage: trace2json [device-or-file] > trace.json
+ *
+ * Without an argument the dump is read from stdin. Anything in front
+ * of the dump, such as boot messages, is skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dump.h"
+
+
+/* must match TRACE_* in include/kernel.h */
+#define TRACE_MAGIC		"TOSTRACE"
+#define TRACE_VERSION		1
+#define TRACE_NAME_LEN		24
+#define TRACE_HEADER_SIZE	28
+#define TRACE_EVENT_SIZE	16
+
+#define TRACE_SWITCH		1
+#define TRACE_IRQ		2
+#define TRACE_STATE		3
+#define TRACE_SEND		4
+#define TRACE_RECEIVE		5
+#define TRACE_REPLY		6
+
+#define TRACE_NO_PROC		0xFFFF
+
+/* the PIT's tick rate: 1193182 Hz / 65536 */
+#define TICKS_PER_SEC		(1193182.0 / 65536.0)
+
+/* JSON "pid"s of the two groups of tracks */
+#define CPU_GROUP		0
+#define PROC_GROUP		1
+
+#define MAX_CPUS		64
+
+static const char* state_name[] = {
+    "READY", "SEND_BLOCKED", "REPLY_BLOCKED", "RECEIVE_BLOCKED",
+    "MESSAGE_BLOCKED", "INTR_BLOCKED", "CHANNEL_BLOCKED", "SYNC_BLOCKED",
+    "PERIOD_BLOCKED"
+};
+
+const char* tool_name = "trace2json";
+
+static unsigned num_procs;
+static char (*proc_name)[TRACE_NAME_LEN + 1];
+static double us_per_cycle;
+static unsigned long long first_tsc;
+static int first_json_event = 1;
+
+
+static unsigned long long get64(const unsigned char* p)
+{
+    return get32(p) | ((unsigned long long) get32(p + 4) << 32);
+}
+
+/* the result stays valid until the second call after this one */
+static const char* name_of(unsigned proc)
+{
+    static char buf[2][32];
+    static int n;
+
+    if (proc < num_procs && proc_name[proc][0] != '\0')
+	return proc_name[proc];
+    n ^= 1;
+    sprintf(buf[n], "Process %u", proc);
+    return buf[n];
+}
+
+/* writes a string as a JSON string literal */
+static void put_string(const char* s)
+{
+    putchar('"');
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    printf("\\%c", *s);
+	else if ((unsigned char) *s < ' ' || (unsigned char) *s > '~')
+	    printf("\\u%04x", (unsigned char) *s);
+	else
+	    putchar(*s);
+    }
+    putchar('"');
+}
+
+static void begin_event()
+{
+    printf(first_json_event ? "\n  " : ",\n  ");
+    first_json_event = 0;
+}
+
+static double to_us(unsigned long long tsc)
+{
+    return (tsc - first_tsc) * us_per_cycle;
+}
+
+static void track_name(int group, unsigned tid, const char* name)
+{
+    begin_event();
+    printf("{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, "
+	   "\"tid\": %u, \"args\": {\"name\": ", group, tid);
+    put_string(name);
+    printf("}}");
+}
+
+static void slice(int group, unsigned tid, const char* name,
+		  unsigned long long start, unsigned long long end)
+{
+    begin_event();
+    printf("{\"ph\": \"X\", \"name\": ");
+    put_string(name);
+    printf(", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+	   group, tid, to_us(start), to_us(end) - to_us(start));
+}
+
+/* an event on the track of cpu, with one or two (key2 != NULL) args */
+static void instant(unsigned cpu, const char* name, unsigned long long tsc,
+		    const char* key1, const char* value1,
+		    const char* key2, const char* value2)
+{
+    begin_event();
+    printf("{\"ph\": \"i\", \"s\": \"t\", \"name\": ");
+    put_string(name);
+    printf(", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"args\": {",
+	   CPU_GROUP, cpu, to_us(tsc));
+    put_string(key1);
+    printf(": ");
+    put_string(value1);
+    if (key2 != NULL) {
+	printf(", ");
+	put_string(key2);
+	printf(": ");
+	put_string(value2);
+    }
+    printf("}}");
+}
+
+
+int main(int argc, char** argv)
+{
+    unsigned char header[TRACE_HEADER_SIZE - 8];
+    unsigned char e[TRACE_EVENT_SIZE];
+    unsigned version, tsc_per_tick, num_events, lost, i;
+    unsigned long long tsc, last_tsc = 0;
+    /* what runs on each CPU, and the state of each process, since when */
+    int running[MAX_CPUS];
+    unsigned long long running_since[MAX_CPUS];
+    int *state;
+    unsigned long long *state_since;
+    unsigned type, cpu, proc, arg;
+    char name[64];
+
+    if (argc > 2) {
+	fprintf(stderr, "usage: trace2json [device-or-file] > trace.json\n");
+	return 2;
+    }
+    open_dump(argc == 2 ? argv[1] : NULL);
+
+    find_magic(TRACE_MAGIC, strlen(TRACE_MAGIC), "trace");
+    read_bytes(header, sizeof(header));
+    version = get32(header);
+    tsc_per_tick = get32(header + 4);
+    num_procs = get32(header + 8);
+    num_events = get32(header + 12);
+    lost = get32(header + 16);
+    if (version != TRACE_VERSION)
+	die("unknown trace version");
+    if (tsc_per_tick == 0)
+	die("the trace has no time base");
+    us_per_cycle = 1e6 / (tsc_per_tick * TICKS_PER_SEC);
+
+    proc_name = calloc(num_procs, sizeof(*proc_name));
+    state = malloc(num_procs * sizeof(int));
+    state_since = malloc(num_procs * sizeof(unsigned long long));
+    if (proc_name == NULL || state == NULL || state_since == NULL)
+	die("out of memory");
+    for (i = 0; i < num_procs; i++) {
+	read_bytes((unsigned char*) proc_name[i], TRACE_NAME_LEN);
+	state[i] = -1;
+    }
+    for (i = 0; i < MAX_CPUS; i++)
+	running[i] = -1;
+
+    printf("{\"displayTimeUnit\": \"ns\", \"otherData\": "
+	   "{\"lost_events\": %u}, \"traceEvents\": [", lost);
+    for (i = 0; i < num_procs; i++)
+	if (proc_name[i][0] != '\0')
+	    track_name(PROC_GROUP, i, name_of(i));
+
+    for (i = 0; i < num_events; i++) {
+	read_bytes(e, sizeof(e));
+	tsc = get64(e);
+	type = e[8];
+	cpu = e[9];
+	proc = e[10] | (e[11] << 8);
+	arg = get32(e + 12);
+	if (i == 0) {
+	    first_tsc = tsc;
+	    for (cpu = 0; cpu < MAX_CPUS; cpu++)
+		running_since[cpu] = tsc;
+	    cpu = e[9];
+	}
+	if (cpu >= MAX_CPUS || proc >= num_procs)
+	    die("corrupt event");
+	last_tsc = tsc;
+
+	switch (type) {
+	case TRACE_SWITCH:
+	    if (running[cpu] >= 0)
+		slice(CPU_GROUP, cpu, name_of(running[cpu]),
+		      running_since[cpu], tsc);
+	    else {
+		sprintf(name, "CPU %u", cpu);
+		track_name(CPU_GROUP, cpu, name);
+	    }
+	    running[cpu] = proc;
+	    running_since[cpu] = tsc;
+	    break;
+
+	case TRACE_STATE:
+	    if (state[proc] >= 0)
+		slice(PROC_GROUP, proc, state_name[state[proc]],
+		      state_since[proc], tsc);
+	    state[proc] = arg < sizeof(state_name) / sizeof(state_name[0])
+			  ? (int) arg : -1;
+	    state_since[proc] = tsc;
+	    break;
+
+	case TRACE_IRQ:
+	    sprintf(name, "IRQ %02x", arg);
+	    instant(cpu, name, tsc, "interrupted", name_of(proc), NULL, NULL);
+	    break;
+
+	case TRACE_SEND:
+	case TRACE_RECEIVE:
+	case TRACE_REPLY:
+	    instant(cpu, type == TRACE_SEND ? "send" :
+			 type == TRACE_RECEIVE ? "receive" : "reply",
+		    tsc, "process", name_of(proc),
+		    type == TRACE_SEND ? "to" : "from",
+		    arg == TRACE_NO_PROC ? "-" : name_of(arg));
+	    break;
+	}
+    }
+
+    /* close what is still open at the end of the trace */
+    for (cpu = 0; cpu < MAX_CPUS; cpu++)
+	if (running[cpu] >= 0)
+	    slice(CPU_GROUP, cpu, name_of(running[cpu]),
+		  running_since[cpu], last_tsc);
+    for (proc = 0; proc < num_procs; proc++)
+	if (state[proc] >= 0)
+	    slice(PROC_GROUP, proc, state_name[state[proc]],
+		  state_since[proc], last_tsc);
+    printf("\n]}\n");
+
+    if (lost != 0)
+	fprintf(stderr, "trace2json: %u older events were overwritten\n",
+		lost);
+    return 0;
+}